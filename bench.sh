@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Times the specialized TLB engines against the generic one
+# (TLB_GENERIC_ENGINE=1) for a range of TLB sizes. Both are built
+# in a scratch directory, so the working tree is left alone.
+
+INSTRUCTIONS=3000000
+SIZES="16 64 256 1024 4096"
+
+TIMEFORMAT=%R
+
+SRCDIR=$(cd "$(dirname "$0")" && pwd)
+BUILD=$(mktemp -d)
+trap 'rm -rf "$BUILD"' EXIT
+
+cp "$SRCDIR"/*.c "$SRCDIR"/*.h "$SRCDIR"/mmu.o "$SRCDIR"/Makefile "$BUILD" || exit 1
+for GENERIC in 0 1; do
+  make -C "$BUILD" clean > /dev/null
+  make -C "$BUILD" proj3 DEFS="-DTLB_GENERIC_ENGINE=$GENERIC" > /dev/null || exit 1
+  mv "$BUILD/proj3" "$BUILD/proj3_generic$GENERIC"
+done
+
+for T in $SIZES; do
+  # enough pages to keep most of the TLB busy, few enough to hit
+  P=$((T * 3 / 4))
+  ARGS="-t$T -p$P -f4096 -n$INSTRUCTIONS"
+  echo -n "TLB entries $T, specialized: "
+  { time "$BUILD/proj3_generic0" $ARGS > /dev/null ; } 2>&1
+  echo -n "TLB entries $T, generic:     "
+  { time "$BUILD/proj3_generic1" $ARGS > /dev/null ; } 2>&1
+done
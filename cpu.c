@@ -0,0 +1,260 @@
+/***********************************/
+/********* Simulated CPU ***********/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+/* Issues the instructions of the simulated process and drives the
+   clock. This follows the cpu.o that was handed out with the
+   project, so without -w it prints exactly what ben prints. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "tlb.h"
+#include "kernel.h"
+#include "workload.h"
+#include "timeseries.h"
+
+// Simulated time charged for an instruction, and for waiting
+// on a page fault. A clock interrupt occurs every CLOCK_TICK.
+#define INSTRUCTION_TIME  1
+#define PAGE_FAULT_TIME   10000
+#define CLOCK_TICK        100000
+
+typedef struct {
+  OPERATION op;
+  ADDRESS address;
+} INSTRUCTION;
+
+BOOL verbose;
+
+unsigned int num_pages;
+unsigned int num_pages_mod_mask;
+unsigned int num_page_frames;
+
+int page_fault_count;
+int page_writeback_count;
+
+VPAGE_NUMBER current_page;
+VPAGE_NUMBER last_page;
+unsigned int current_offset = 100;
+OPERATION current_op;
+BOOL read_only_page = TRUE;
+
+int num_new_page_refs = 1;
+int num_stores;
+int num_read_only_pages;
+
+static BOOL page_fault_trap_issued;
+
+
+/*************************************/
+/******* Instruction generator *******/
+/*************************************/
+
+/* Returns the current instruction and picks the next one. Most
+   instructions touch the next word of the same page; now and then
+   the process jumps to a random page, 30% of which are read-only
+   and never stored to. */
+INSTRUCTION issue_instruction()
+{
+  INSTRUCTION instr;
+
+  instr.address = (current_page << 12) | (current_offset & 0xFFF);
+  instr.op = current_op;
+
+  if (workload_selected) {
+    workload_next(&current_op, &current_page, &current_offset);
+    return instr;
+  }
+
+  if (!read_only_page && rand() % 1000 < 100)
+    current_op = STORE;
+  else
+    current_op = LOAD;
+
+  if (rand() % 1000 < 10) {
+    current_page = rand() & num_pages_mod_mask;
+    current_offset = rand() & 0xFFF;
+    read_only_page = (rand() % 1000 < 300);
+    if (read_only_page) num_read_only_pages++;
+  }
+  else if (rand() % 1000 < 950)
+    current_offset = (current_offset + 4) & 0xFFF;
+  else
+    current_offset = rand() & 0xFFF;
+
+  return instr;
+}
+
+
+/*************************************/
+/********* Argument parsing **********/
+/*************************************/
+
+// Rounds n up to a power of 2.
+unsigned int round_up_pow2(int n)
+{
+  unsigned int result = 1;
+  int i;
+  for (i = n; i != 1; i = i >> 1) result = result * 2;
+  if (result < n) result = result * 2;
+  return result;
+}
+
+int main(int argc, char *argv[])
+{
+  int num_instructions = 1000000;
+  unsigned int time;
+  unsigned int i;
+  int n;
+  char *arg;
+  INSTRUCTION instr;
+  OPERATION op;
+  ADDRESS address;
+  ADDRESS paddress;
+  VPAGE_NUMBER fork_parent;
+  VPAGE_NUMBER fork_child;
+  unsigned int fork_count;
+
+  num_pages = 0x100000;
+  num_pages_mod_mask = 0xFFFFF;
+  num_page_frames = 1024;
+  num_tlb_entries = 32;
+
+  for (i = 1; i < argc; i++) {
+    arg = argv[i];
+    if (arg[0] != '-') {
+      printf("Invalid argument: %s\n", arg);
+      exit(1);
+    }
+    switch (arg[1]) {
+    case 'n':
+      num_instructions = atoi(arg + 2);
+      if (num_instructions <= 0) {
+        printf("Invalid number of instructions: %s\n", arg + 2);
+        exit(1);
+      }
+      break;
+    case 'f':
+      n = atoi(arg + 2);
+      if (n == 0 || (unsigned int) n > 0x100000) {
+        printf("Invalid number of page frames: %s\n", arg + 2);
+        exit(1);
+      }
+      num_page_frames = round_up_pow2(n);
+      break;
+    case 'p':
+      n = atoi(arg + 2);
+      if (n == 0 || (unsigned int) n > 0x100000) {
+        printf("Invalid number of virtual pages: %s\n", arg + 2);
+        exit(1);
+      }
+      num_pages = round_up_pow2(n);
+      num_pages_mod_mask = num_pages - 1;
+      break;
+    case 't':
+      n = atoi(arg + 2);
+      if (n == 0) {
+        printf("Invalid number of TLB entries: %s\n", arg + 2);
+        exit(1);
+      }
+      num_tlb_entries = round_up_pow2(n);
+      break;
+    case 'v':
+      verbose = TRUE;
+      if (arg[2] != '\0') {
+        printf("Invalid flag: %s\n", arg + 2);
+        exit(1);
+      }
+      break;
+    case 'w':
+      workload_select(arg + 2);
+      break;
+    default:
+      printf("Invalid flag: %s\n", arg);
+      exit(1);
+    }
+  }
+
+  printf("Number of instructions: %d\n", num_instructions);
+  printf("Number of pages: %d\n", num_pages);
+  printf("Number of page frames: %d\n", num_page_frames);
+  printf("Number of TLB entries: %d\n", num_tlb_entries);
+
+  time = 0;
+  page_fault_count = 0;
+  initialize_kernel();
+  mmu_initialize();
+  srand(1000);
+  if (workload_selected) workload_initialize(&current_op, &current_page, &current_offset);
+  timeseries_initialize();
+
+
+/*************************************/
+/********* Instruction loop **********/
+/*************************************/
+
+  for (i = 0; i != num_instructions; i++) {
+    instr = issue_instruction();
+    if (workload_selected && workload_fork(&fork_parent, &fork_child, &fork_count))
+      kernel_share_range(fork_parent, fork_child, fork_count);
+    if (verbose)
+      printf("Issuing instruction:  %s  %x\n", instr.op == STORE ? "STORE" : "LOAD ", instr.address);
+    op = instr.op;
+    address = instr.address;
+
+    if (op == STORE) num_stores++;
+    if ((address >> 12) != last_page) {
+      num_new_page_refs++;
+      last_page = address >> 12;
+    }
+
+    paddress = mmu_translate(address, op);
+    time += INSTRUCTION_TIME;
+
+    while (page_fault_trap_issued) {
+      page_fault_count++;
+      page_fault_trap_issued = FALSE;
+      if (verbose) {
+        printf("Page fault on page %x. Process blocks...\n", address >> 12);
+        printf("Page has been fetched, process resumes by reissuing instruction\n");
+      }
+      paddress = mmu_translate(address, op);
+      time += PAGE_FAULT_TIME;
+    }
+
+    if (verbose)
+      printf("Virtual address %x has been translated to physical address %x\n", address, paddress);
+
+    if (time >= CLOCK_TICK) {
+      if (verbose) printf("Clock Interrupt\n");
+      issue_clock_interrupt();
+      time = 0;
+      if (timeseries_at_clock) timeseries_sample(i + 1);
+    }
+    if (i + 1 == timeseries_next_sample) timeseries_sample(i + 1);
+  }
+  timeseries_finish(num_instructions);
+
+  printf("Total Number of instructions: %d\n", num_instructions);
+  printf("    Load Instructions: %d\n", num_instructions - num_stores);
+  printf("    Store Instructions: %d\n", num_stores);
+  printf("    Pages Encountered: %d\n", num_new_page_refs);
+  printf("    Read-only Pages Encountered: %d\n", num_read_only_pages);
+  printf("    TLB misses:  %d\n", tlb_miss_count);
+  printf("    Page Faults: %d\n", page_fault_count);
+  printf("    Pages evicted from memory: %d\n", evicted_page_count);
+  printf("    Evicted pages written back to disk: %d\n", evicted_page_written_to_disk_count);
+  return 0;
+}
+
+//This procedure (called by the MMU) causes the hardware to
+//issue a page fault trap.
+void issue_page_fault_trap(VPAGE_NUMBER vpage)
+{
+  page_fault_trap_issued = TRUE;
+  handle_page_fault_trap(vpage);
+}
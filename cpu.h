@@ -9,8 +9,16 @@ extern BOOL verbose;
 // (see documentation).
 extern unsigned int num_page_frames;
 
+// The number of virtual pages the process uses (a power of 2),
+// and that number minus 1, to perform MOD operations.
+extern unsigned int num_pages;
+extern unsigned int num_pages_mod_mask;
+
 //This procedure (called by the MMU) causes the hardware to
 //issue a page fault trap. It specifies which virtual page
 //caused the page fault (i.e. the virtual page was not
 //in memory).
 void  issue_page_fault_trap(VPAGE_NUMBER vpage);
+
+// Page faults taken so far, as printed at the end of the run.
+extern int page_fault_count;
@@ -0,0 +1,161 @@
+/***********************************/
+/****** Simulated paging disk ******/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "disk.h"
+
+/*************************************/
+/********* Disk model params *********/
+/*************************************/
+
+// Fixed cost of every I/O (seek, rotation, controller).
+#ifndef DISK_ACCESS_LATENCY_US
+  #define DISK_ACCESS_LATENCY_US 100
+#endif
+
+// Transfer rate in MB/s, i.e. bytes per microsecond.
+#ifndef DISK_BANDWIDTH_MB
+  #define DISK_BANDWIDTH_MB 200
+#endif
+
+// Writes held before they are issued as one batch. 0 issues
+// every write on its own, as soon as it is queued.
+#ifndef WRITEBACK_QUEUE_DEPTH
+  #define WRITEBACK_QUEUE_DEPTH 0
+#endif
+
+#define PAGE_SIZE 4096
+#define PAGE_TRANSFER_US ((PAGE_SIZE + DISK_BANDWIDTH_MB - 1) / DISK_BANDWIDTH_MB)
+
+unsigned long long current_time;   // simulated time
+unsigned long long disk_free_at;   // when the disk finishes its last I/O
+
+VPAGE_NUMBER write_queue[WRITEBACK_QUEUE_DEPTH + 1];
+unsigned int write_queue_length;
+
+unsigned long long disk_stall_time;
+unsigned int disk_stall_count;
+unsigned int disk_reads;
+unsigned int disk_pages_read;
+unsigned int disk_pages_written;
+unsigned int disk_write_ios;
+
+void disk_initialize()
+{
+  current_time = 0;
+  disk_free_at = 0;
+  write_queue_length = 0;
+  disk_stall_time = 0;
+  disk_stall_count = 0;
+  disk_reads = 0;
+  disk_pages_read = 0;
+  disk_pages_written = 0;
+  disk_write_ios = 0;
+}
+
+void disk_advance_time(unsigned int us)
+{
+  current_time += us;
+}
+
+BOOL disk_idle()
+{
+  return disk_free_at <= current_time;
+}
+
+/* Puts an I/O of the given number of pages on the disk after
+   everything already issued. */
+void start_io(unsigned int pages)
+{
+  unsigned long long start = (disk_free_at > current_time) ? disk_free_at : current_time;
+  disk_free_at = start + DISK_ACCESS_LATENCY_US + pages * PAGE_TRANSFER_US;
+}
+
+int compare_vpages(const void *a, const void *b)
+{
+  VPAGE_NUMBER x = *(const VPAGE_NUMBER *) a;
+  VPAGE_NUMBER y = *(const VPAGE_NUMBER *) b;
+  return (x > y) - (x < y);
+}
+
+/* Sorting the queue lines up pages that sit next to each other on
+   disk; each run of consecutive pages becomes one I/O, and a page
+   queued twice is written once. */
+void disk_issue_writes()
+{
+  unsigned int i = 0;
+  unsigned int run;
+
+  qsort(write_queue, write_queue_length, sizeof(VPAGE_NUMBER), compare_vpages);
+  while (i < write_queue_length) {
+    run = 1;
+    i++;
+    while (i < write_queue_length && write_queue[i] - write_queue[i - 1] <= 1) {
+      if (write_queue[i] != write_queue[i - 1]) run++;
+      i++;
+    }
+    start_io(run);
+    disk_pages_written += run;
+    disk_write_ios++;
+  }
+  write_queue_length = 0;
+}
+
+void disk_queue_write(VPAGE_NUMBER vpage)
+{
+  if (write_queue_length == WRITEBACK_QUEUE_DEPTH) disk_issue_writes();
+  write_queue[write_queue_length++] = vpage;
+  if (WRITEBACK_QUEUE_DEPTH == 0) disk_issue_writes();
+}
+
+// Returns TRUE if any of the count pages starting at vpage is in
+// the queue.
+BOOL range_write_queued(VPAGE_NUMBER vpage, unsigned int count)
+{
+  unsigned int i;
+  for (i = 0; i < write_queue_length; i++) {
+    if (write_queue[i] - vpage < count) return TRUE;
+  }
+  return FALSE;
+}
+
+BOOL disk_write_queued(VPAGE_NUMBER vpage)
+{
+  return range_write_queued(vpage, 1);
+}
+
+void disk_read_page(VPAGE_NUMBER vpage)
+{
+  disk_read_pages(vpage, 1);
+}
+
+void disk_read_pages(VPAGE_NUMBER vpage, unsigned int count)
+{
+  // A page whose write is still queued would be read back stale.
+  // Issuing the queue puts the write on the disk ahead of the read.
+  if (range_write_queued(vpage, count)) disk_issue_writes();
+  start_io(count);
+  disk_reads++;
+  disk_pages_read += count;
+  disk_stall_time += disk_free_at - current_time;
+  disk_stall_count++;
+  current_time = disk_free_at;
+}
+
+void disk_print_statistics()
+{
+  printf("    Disk reads: %d\n", disk_reads);
+  if (disk_pages_read != disk_reads)
+    printf("    Pages per read I/O: %.2f\n", (double) disk_pages_read / disk_reads);
+  printf("    Disk pages written: %d\n", disk_pages_written);
+  printf("    Disk write I/Os: %d\n", disk_write_ios);
+  if (disk_write_ios > 0)
+    printf("    Pages per write I/O: %.2f\n", (double) disk_pages_written / disk_write_ios);
+  printf("    Page fault stall time (us): %llu\n", disk_stall_time);
+  if (disk_stall_count > 0)
+    printf("    Stall time per page fault (us): %.1f\n", (double) disk_stall_time / disk_stall_count);
+}
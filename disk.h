@@ -0,0 +1,38 @@
+
+/* The paging disk. Reads are synchronous: the faulting process
+   stalls until its page arrives. Writes of dirty pages go through
+   a write-back queue and are issued in batches, with pages that
+   are adjacent on disk (consecutive virtual pages) coalesced into
+   a single I/O. The disk serves I/Os in order, so a read also waits
+   for the writes issued before it. All times are in microseconds
+   of simulated time. */
+
+void disk_initialize();
+
+// Moves simulated time forward (called at each clock interrupt).
+void disk_advance_time(unsigned int us);
+
+// Adds the specified virtual page to the write-back queue. If the
+// queue is full, it is issued first. With a queue depth of 0 the
+// write is issued right away.
+void disk_queue_write(VPAGE_NUMBER vpage);
+
+// Returns TRUE if the page is in the queue and not yet issued.
+BOOL disk_write_queued(VPAGE_NUMBER vpage);
+
+// Issues every queued write, without waiting for them.
+void disk_issue_writes();
+
+// Returns TRUE if the disk has no I/O in progress.
+BOOL disk_idle();
+
+// Reads the specified virtual page, stalling until it arrives.
+void disk_read_page(VPAGE_NUMBER vpage);
+
+// Reads count pages, starting at the specified one, in one I/O.
+// Queued writes of any of them are issued first.
+void disk_read_pages(VPAGE_NUMBER vpage, unsigned int count);
+
+void disk_print_statistics();
+
+extern unsigned long long disk_stall_time;
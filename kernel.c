@@ -0,0 +1,822 @@
+/***********************************/
+/****** Simulated OS kernel ********/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+/* Page fault handling and page frame replacement. This follows
+   the kernel.o that was handed out with the project, so the default
+   (clock) configuration prints exactly what ben prints. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "kernel.h"
+#include "mmu.h"
+#include "page.h"
+#include "tlb.h"
+#include "cpu.h"
+#include "disk.h"
+#include "snapshot.h"
+#include "profile.h"
+
+/*************************************/
+/****** Page replacement choice ******/
+/*************************************/
+
+// The policies are listed in kernel.h.
+#ifndef PAGE_REPLACEMENT
+  #define PAGE_REPLACEMENT CLOCK_REPLACEMENT
+#endif
+
+/* At each clock interrupt, up to CLEANER_PAGES dirty pages that
+   were not referenced since the last one are written to disk ahead
+   of their eviction. 0 turns the cleaner off. */
+#ifndef CLEANER_PAGES
+  #define CLEANER_PAGES 0
+#endif
+
+// Simulated time between two clock interrupts.
+#ifndef CLOCK_INTERRUPT_US
+  #define CLOCK_INTERRUPT_US 1000
+#endif
+
+/* On a page fault, up to this many of the pages that follow the
+   faulting one are read in the same disk I/O and mapped as well
+   (see fault_around). 0 turns fault-around off. */
+#ifndef FAULT_AROUND_PAGES
+  #define FAULT_AROUND_PAGES 0
+#endif
+
+// Set to 1 to print the kernel and disk statistics at exit.
+#ifndef KERNEL_STATISTICS
+  #define KERNEL_STATISTICS 0
+#endif
+
+int page_replacement = PAGE_REPLACEMENT;
+unsigned int fault_around_pages = FAULT_AROUND_PAGES;
+unsigned int cleaner_pages = CLEANER_PAGES;
+
+unsigned int evicted_page_count;
+unsigned int evicted_page_written_to_disk_count;
+unsigned int pages_cleaned;
+
+unsigned int int_size_shift;      // log2 of the bits in a bitmap word
+unsigned int mod_num_pageframes;  // num_page_frames - 1, for MOD
+
+// Maps each page frame to the virtual page it holds.
+VPAGE_NUMBER *inverse_page_table;
+
+// The clock hand: where the next search for a victim starts.
+PAGEFRAME_NUMBER start_evict_pageframe_search = 0;
+
+// Number of clock interrupts so far; the virtual time of WSClock.
+unsigned int virtual_time = 0;
+
+// Per page frame: virtual time of last reference (WSClock) and
+// aging counter (aging).
+unsigned int *last_use_time;
+unsigned char *age_counter;
+
+#define BITS_PER_WORD 32
+#define WORD_MOD_MASK 0x1F
+#define NO_FRAME (~0x0)
+#define NUM_VPAGES 0x100000  // pages in the 32-bit address space
+
+/* After kernel_share_range, a page frame may be mapped read-only by
+   several virtual pages. inverse_page_table holds one of them and
+   shared_pages lists the others; frame_map_count counts them all. */
+typedef struct SHARED_PAGE {
+  VPAGE_NUMBER vpage;
+  struct SHARED_PAGE *next;
+} SHARED_PAGE;
+
+SHARED_PAGE **shared_pages;
+unsigned int *frame_map_count;
+
+// Mappings beyond the first of each frame, that is, page frames
+// saved by sharing: now, at most, and summed over clock interrupts.
+unsigned int pages_sharing;
+unsigned int peak_pages_sharing;
+unsigned long long pages_sharing_sum;
+
+unsigned int shared_mappings;
+unsigned int cow_faults;
+unsigned int cow_copies;
+
+// Per page frame: TRUE while it holds a page read ahead by
+// fault_around that has not been referenced yet.
+unsigned char *read_ahead_frame;
+unsigned int read_ahead_pending;
+
+unsigned int fault_around_window = 0;
+VPAGE_NUMBER fault_around_next = NO_FRAME;  // just past the last fault's pages
+
+unsigned int pages_read_ahead;
+unsigned int read_ahead_used;     // page faults avoided
+unsigned int read_ahead_wasted;   // evicted or unmapped unreferenced
+
+void print_kernel_statistics();
+
+void initialize_kernel()
+{
+  int_size_shift = 5;
+  evicted_page_count = 0;
+  evicted_page_written_to_disk_count = 0;
+  inverse_page_table = malloc(num_page_frames * sizeof(VPAGE_NUMBER));
+  mod_num_pageframes = num_page_frames - 1;
+
+  last_use_time = calloc(num_page_frames, sizeof(unsigned int));
+  age_counter = calloc(num_page_frames, sizeof(unsigned char));
+  shared_pages = calloc(num_page_frames, sizeof(SHARED_PAGE *));
+  frame_map_count = calloc(num_page_frames, sizeof(unsigned int));
+  read_ahead_frame = calloc(num_page_frames, sizeof(unsigned char));
+
+  pages_cleaned = 0;
+  disk_initialize();
+  if (KERNEL_STATISTICS) atexit(print_kernel_statistics);
+  if (HOT_PAGE_PROFILE) profile_initialize();
+  snapshot_initialize();
+}
+
+void print_kernel_statistics()
+{
+  printf("Kernel statistics:\n");
+  printf("    Pages pre-cleaned: %d\n", pages_cleaned);
+  if (peak_pages_sharing > 0) {
+    printf("    Shared mappings made: %u\n", shared_mappings);
+    printf("    Page frames saved by sharing: %u at exit, %u at peak, %.1f on average\n",
+           pages_sharing, peak_pages_sharing,
+           virtual_time > 0 ? (double) pages_sharing_sum / virtual_time : 0.0);
+    printf("    Copy-on-write faults: %u, pages copied: %u\n", cow_faults, cow_copies);
+  }
+  if (fault_around_pages > 0) {
+    printf("    Pages read ahead (extra page frames): %u\n", pages_read_ahead);
+    printf("    Page faults avoided: %u, pages evicted unused: %u\n", read_ahead_used, read_ahead_wasted);
+    printf("    Fault-around window at exit: %u\n", fault_around_window);
+  }
+  disk_print_statistics();
+  tlb_print_statistics();
+}
+
+void print_binary(unsigned int n)
+{
+  unsigned int i;
+  for (i = 0; i < BITS_PER_WORD; i++) {
+    printf("%d ", (n & (0x80000000 >> i)) != 0);
+  }
+  printf("\n");
+}
+
+/*************************************/
+/****** Word-at-a-time scanning ******/
+/*************************************/
+
+#define CLEAN_UNREFERENCED  0  // R = 0, M = 0
+#define DIRTY_UNREFERENCED  1  // R = 0, M = 1
+#define CLEAN_REFERENCED    2  // R = 1, M = 0
+#define UNREFERENCED        3  // R = 0
+
+/* Bits of bitmap word w that stand for real page frames. Since the
+   number of page frames is a power of 2, only a table smaller than
+   a word has a partial word. */
+unsigned int valid_frame_bits(unsigned int w)
+{
+  if (num_page_frames >= BITS_PER_WORD) return ~0U;
+  return (1U << num_page_frames) - 1;
+}
+
+unsigned int frame_class_bits(unsigned int w, int frame_class)
+{
+  unsigned int r = rbit_bitmap[w];
+  unsigned int m = mbit_bitmap[w];
+  unsigned int bits;
+
+  switch (frame_class) {
+  case CLEAN_UNREFERENCED: bits = ~r & ~m; break;
+  case DIRTY_UNREFERENCED: bits = ~r & m; break;
+  case CLEAN_REFERENCED:   bits = r & ~m; break;
+  default:                 bits = ~r; break;
+  }
+  return bits & valid_frame_bits(w);
+}
+
+/* Returns the first page frame of the given class found going
+   around the clock from start, or NO_FRAME. A word at a time is
+   tested, so runs of frames outside the class cost one AND each. */
+PAGEFRAME_NUMBER find_frame(PAGEFRAME_NUMBER start, int frame_class)
+{
+  unsigned int first_word = start >> int_size_shift;
+  unsigned int start_bit = start & WORD_MOD_MASK;
+  unsigned int w = first_word;
+  unsigned int n, bits;
+
+  for (n = 0; n <= bitmap_size; n++) {
+    bits = frame_class_bits(w, frame_class);
+    if (n == 0) bits = bits & (~0U << start_bit);
+    else if (n == bitmap_size) bits = bits & ~(~0U << start_bit);
+    if (bits) return (w << int_size_shift) + __builtin_ctz(bits);
+    w = (w + 1 == bitmap_size) ? 0 : w + 1;
+  }
+  return NO_FRAME;
+}
+
+/*************************************/
+/***** Page replacement policies *****/
+/*************************************/
+
+/* The original algorithm: the first frame from the clock hand with
+   R = 0 and M = 0, else the first with R = 0 (written back), else the
+   first with M = 0, else the frame at the hand (written back).
+   *cursor is where the original frame-by-frame scan stopped, which
+   is what gets reported to issue_page_writeback. */
+PAGEFRAME_NUMBER choose_clock_victim(BOOL *write_back, PAGEFRAME_NUMBER *cursor)
+{
+  PAGEFRAME_NUMBER start = start_evict_pageframe_search;
+  PAGEFRAME_NUMBER victim;
+
+  *write_back = FALSE;
+  victim = find_frame(start, CLEAN_UNREFERENCED);
+  if (victim != NO_FRAME) {
+    *cursor = (victim + 1) & mod_num_pageframes;
+    return victim;
+  }
+
+  *cursor = start;
+  victim = find_frame(start, DIRTY_UNREFERENCED);
+  if (victim != NO_FRAME) {
+    *write_back = TRUE;
+    return victim;
+  }
+  victim = find_frame(start, CLEAN_REFERENCED);
+  if (victim != NO_FRAME) {
+    return victim;
+  }
+  *write_back = TRUE;
+  return start;
+}
+
+BOOL outside_working_set(PAGEFRAME_NUMBER pframe)
+{
+  return virtual_time - last_use_time[pframe] > WORKING_SET_WINDOW;
+}
+
+/* WSClock: going around from the hand, and only looking at frames
+   whose R bit is clear, take the first clean page outside the
+   working set. Failing that, take the first dirty page outside the
+   working set, then the first clean page, then the first
+   unreferenced page, and finally the frame at the hand. */
+PAGEFRAME_NUMBER choose_wsclock_victim(BOOL *write_back)
+{
+  PAGEFRAME_NUMBER start = start_evict_pageframe_search;
+  PAGEFRAME_NUMBER old_dirty = NO_FRAME;
+  PAGEFRAME_NUMBER young_clean = NO_FRAME;
+  PAGEFRAME_NUMBER unreferenced = NO_FRAME;
+  unsigned int first_word = start >> int_size_shift;
+  unsigned int start_bit = start & WORD_MOD_MASK;
+  unsigned int w = first_word;
+  unsigned int n, bits, m;
+  PAGEFRAME_NUMBER f;
+
+  for (n = 0; n <= bitmap_size; n++) {
+    bits = frame_class_bits(w, UNREFERENCED);
+    if (n == 0) bits = bits & (~0U << start_bit);
+    else if (n == bitmap_size) bits = bits & ~(~0U << start_bit);
+    m = mbit_bitmap[w];
+
+    while (bits) {
+      unsigned int b = __builtin_ctz(bits);
+      bits = bits & (bits - 1);
+      f = (w << int_size_shift) + b;
+
+      if (unreferenced == NO_FRAME) unreferenced = f;
+      if (outside_working_set(f)) {
+        if ((m & (1U << b)) == 0) {
+          *write_back = FALSE;
+          return f;
+        }
+        if (old_dirty == NO_FRAME) old_dirty = f;
+      }
+      else if ((m & (1U << b)) == 0 && young_clean == NO_FRAME) {
+        young_clean = f;
+      }
+    }
+    w = (w + 1 == bitmap_size) ? 0 : w + 1;
+  }
+
+  if (old_dirty != NO_FRAME) {
+    *write_back = TRUE;
+    return old_dirty;
+  }
+  if (young_clean != NO_FRAME) {
+    *write_back = FALSE;
+    return young_clean;
+  }
+  f = (unreferenced != NO_FRAME) ? unreferenced : start;
+  *write_back = mmu_get_mbit_bitmap_value(f);
+  return f;
+}
+
+/* Aging: the frame with the smallest counter, with a reference
+   since the last clock interrupt counting as the top bit. Ties go
+   to a clean page, then to the first one from the hand. */
+PAGEFRAME_NUMBER choose_aging_victim(BOOL *write_back)
+{
+  PAGEFRAME_NUMBER start = start_evict_pageframe_search;
+  PAGEFRAME_NUMBER f = start;
+  PAGEFRAME_NUMBER victim = start;
+  unsigned int best = ~0x0;
+  unsigned int n, key;
+
+  for (n = 0; n < num_page_frames; n++) {
+    key = age_counter[f] << 1;
+    if (mmu_get_rbit_bitmap_value(f)) key = key | 0x200;
+    if (mmu_get_mbit_bitmap_value(f)) key = key | 0x1;
+    if (key < best) {
+      best = key;
+      victim = f;
+      if (key == 0) break;
+    }
+    f = (f + 1) & mod_num_pageframes;
+  }
+  *write_back = best & 0x1;
+  return victim;
+}
+
+/*************************************/
+/*********** Shared pages ************/
+/*************************************/
+
+void issue_page_writeback(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe)
+{
+  evicted_page_written_to_disk_count++;
+  if (verbose)
+    printf("Writing page %x in pageframe %x back to disk\n", vpage, pframe);
+  disk_queue_write(vpage);
+}
+
+void add_shared_page(PAGEFRAME_NUMBER pframe, VPAGE_NUMBER vpage)
+{
+  SHARED_PAGE *page = malloc(sizeof(SHARED_PAGE));
+  page->vpage = vpage;
+  page->next = shared_pages[pframe];
+  shared_pages[pframe] = page;
+  frame_map_count[pframe]++;
+  shared_mappings++;
+  pages_sharing++;
+  if (pages_sharing > peak_pages_sharing) peak_pages_sharing = pages_sharing;
+}
+
+// Removes vpage from the pages mapping pframe, which must be more
+// than one. If vpage is the one in inverse_page_table, another of
+// them takes its place.
+void remove_shared_page(PAGEFRAME_NUMBER pframe, VPAGE_NUMBER vpage)
+{
+  SHARED_PAGE **link = &shared_pages[pframe];
+  SHARED_PAGE *page;
+
+  if (inverse_page_table[pframe] == vpage) {
+    inverse_page_table[pframe] = (*link)->vpage;
+  }
+  else {
+    while ((*link)->vpage != vpage) link = &(*link)->next;
+  }
+  page = *link;
+  *link = page->next;
+  free(page);
+  frame_map_count[pframe]--;
+  pages_sharing--;
+}
+
+/* When a shared frame is evicted, the pages in shared_pages are
+   unmapped along with the one in inverse_page_table. Each has its
+   own copy on disk, which may never have held the frame, so the
+   frame is written back for each of them. */
+void evict_shared_pages(PAGEFRAME_NUMBER pframe)
+{
+  SHARED_PAGE *page;
+
+  while ((page = shared_pages[pframe]) != NULL) {
+    tlb_clear_entry(page->vpage);
+    issue_page_writeback(page->vpage, pframe);
+    pt_clear_page_table_entry(page->vpage);
+    shared_pages[pframe] = page->next;
+    free(page);
+    pages_sharing--;
+  }
+  frame_map_count[pframe] = 1;
+  disk_issue_writes();
+}
+
+/* Maps count virtual pages starting at to onto the page frames of
+   those starting at from, the way fork does: both become read-only,
+   and the first STORE to either one gives it a private copy. Pages
+   of the to range are unmapped first; pages of the from range that
+   are not present are not shared. */
+void kernel_share_range(VPAGE_NUMBER from, VPAGE_NUMBER to, unsigned int count)
+{
+  PAGEFRAME_NUMBER f;
+  unsigned int i;
+
+  if (to - from < count || from - to < count) {
+    printf("Error: cannot share %d pages from page %x with page %x\n", count, from, to);
+    exit(1);
+  }
+
+  kernel_unmap_range(to, count);
+  // Hands the M and R bits to the MMU and drops the writable entries.
+  tlb_clear_range(from, count);
+  for (i = 0; i < count; i++) {
+    f = pt_lookup_pageframe(from + i);
+    if (f == NO_FRAME) continue;
+    pt_update_pagetable_read_only(from + i, f);
+    pt_update_pagetable_read_only(to + i, f);
+    add_shared_page(f, to + i);
+  }
+}
+
+
+/*************************************/
+/*********** Fault-around ************/
+/*************************************/
+
+// Maps vpage to pframe, with clear M and R bits and a fresh
+// replacement history.
+void map_page(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe)
+{
+  pt_update_pagetable(vpage, pframe);
+  inverse_page_table[pframe] = vpage;
+  frame_map_count[pframe] = 1;
+  last_use_time[pframe] = virtual_time;
+  age_counter[pframe] = 0;
+  // The M and R bits left in the bitmaps belong to the old page.
+  mmu_modify_mbit_bitmap(pframe, 0);
+  mmu_modify_rbit_bitmap(pframe, 0);
+}
+
+// Settles a page read ahead into pframe, when the frame is evicted
+// or freed: a fault avoided if it was referenced, else a wasted
+// frame, which halves the window.
+void retire_read_ahead(PAGEFRAME_NUMBER pframe)
+{
+  if (!read_ahead_frame[pframe]) return;
+  read_ahead_frame[pframe] = FALSE;
+  read_ahead_pending--;
+  if (mmu_get_rbit_bitmap_value(pframe)) read_ahead_used++;
+  else {
+    read_ahead_wasted++;
+    fault_around_window = fault_around_window / 2;
+  }
+}
+
+// Before the R bits are cleared, counts the pages read ahead that
+// have been referenced since.
+void record_read_ahead_use()
+{
+  PAGEFRAME_NUMBER f;
+
+  for (f = 0; f < num_page_frames && read_ahead_pending > 0; f++) {
+    if (read_ahead_frame[f] && mmu_get_rbit_bitmap_value(f)) {
+      read_ahead_frame[f] = FALSE;
+      read_ahead_pending--;
+      read_ahead_used++;
+    }
+  }
+}
+
+/* A page frame for a page read ahead: a free one, or else the first
+   unreferenced one from the clock hand, clean if there is one, and
+   written back if not. Returns NO_FRAME rather than take the
+   faulting page's frame, a shared frame, or one read ahead and not
+   used yet. */
+PAGEFRAME_NUMBER claim_read_ahead_frame(PAGEFRAME_NUMBER faulting)
+{
+  PAGEFRAME_NUMBER f = mmu_get_free_page_frame();
+  VPAGE_NUMBER vpage;
+
+  if (f != NO_FREE_PAGEFRAME) return f;
+  f = find_frame(start_evict_pageframe_search, CLEAN_UNREFERENCED);
+  if (f == NO_FRAME) f = find_frame(start_evict_pageframe_search, DIRTY_UNREFERENCED);
+  if (f == NO_FRAME || f == faulting || read_ahead_frame[f] || frame_map_count[f] > 1)
+    return NO_FRAME;
+
+  vpage = inverse_page_table[f];
+  if (verbose) printf("Evicted page frame %x containing page %x\n", f, vpage);
+  start_evict_pageframe_search = (f + 1) & mod_num_pageframes;
+  tlb_clear_entry(vpage);
+  if (mmu_get_mbit_bitmap_value(f)) issue_page_writeback(vpage, f);
+  pt_clear_page_table_entry(vpage);
+  evicted_page_count++;
+  // As in handle_page_fault_trap, the write goes out before the read.
+  if (disk_write_queued(vpage)) disk_issue_writes();
+  return f;
+}
+
+/* Maps up to fault_around_window pages that follow vpage, stopping
+   at the first one present, into frames of their own, and returns
+   how many. They are read in the same I/O as vpage, which is loaded
+   into pframe. The window doubles, up to fault_around_pages, when a
+   fault lands just past the pages of the previous one, as happens
+   in a sequential scan; retire_read_ahead halves it for each page
+   that was not used. */
+unsigned int fault_around(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe)
+{
+  PAGEFRAME_NUMBER f;
+  unsigned int n = 0;
+
+  if (vpage == fault_around_next) {
+    fault_around_window = (fault_around_window == 0) ? 1 : fault_around_window * 2;
+    if (fault_around_window > fault_around_pages) fault_around_window = fault_around_pages;
+  }
+
+  while (n < fault_around_window && vpage + n + 1 < num_pages &&
+         pt_lookup_pageframe(vpage + n + 1) == NO_FRAME) {
+    f = claim_read_ahead_frame(pframe);
+    if (f == NO_FRAME) break;
+    n++;
+    if (verbose) printf("Reading ahead page %x into page frame %x\n", vpage + n, f);
+    map_page(vpage + n, f);
+    read_ahead_frame[f] = TRUE;
+    read_ahead_pending++;
+  }
+  pages_read_ahead += n;
+  fault_around_next = vpage + n + 1;
+  return n;
+}
+
+
+/*************************************/
+/********* Kernel entry points *******/
+/*************************************/
+
+// Picks a page frame to evict, writes it back to disk if needed,
+// and removes it from the page table. Returns the page frame.
+PAGEFRAME_NUMBER evict_page()
+{
+  PAGEFRAME_NUMBER victim;
+  PAGEFRAME_NUMBER cursor;
+  VPAGE_NUMBER vpage;
+  BOOL write_back;
+
+  switch (page_replacement) {
+  case WSCLOCK_REPLACEMENT:
+    victim = choose_wsclock_victim(&write_back);
+    cursor = victim;
+    break;
+  case AGING_REPLACEMENT:
+    victim = choose_aging_victim(&write_back);
+    cursor = victim;
+    break;
+  default:
+    victim = choose_clock_victim(&write_back, &cursor);
+    break;
+  }
+
+  if (!mmu_get_pageframe_bitmap_value(victim)) {
+    printf("Error: trying to evict a page when there is an empty pageframe: %x\n", victim);
+    exit(1);
+  }
+
+  if (verbose)
+    printf("Page frame found to evict: %x, mbit is %d, write_back = %d\n",
+           victim, mmu_get_mbit_bitmap_value(victim), write_back);
+
+  start_evict_pageframe_search = (victim + 1) & mod_num_pageframes;
+  if (fault_around_pages > 0) retire_read_ahead(victim);
+  vpage = inverse_page_table[victim];
+  if (write_back) issue_page_writeback(vpage, cursor);
+  pt_clear_page_table_entry(vpage);
+  if (frame_map_count[victim] > 1) evict_shared_pages(victim);
+  return victim;
+}
+
+void handle_page_fault_trap(VPAGE_NUMBER vpage)
+{
+  PAGEFRAME_NUMBER pframe;
+  PAGEFRAME_NUMBER evicted;
+  PAGEFRAME_NUMBER shared;
+  unsigned int n;
+
+  if (verbose) printf("Handling page fault for page %x\n", vpage);
+  if (HOT_PAGE_PROFILE) profile_page_fault(vpage);
+
+  // A page that is present faults only on a STORE while it is
+  // read-only. The last page left mapping a frame gets it back.
+  shared = pt_lookup_pageframe(vpage);
+  if (shared != NO_FRAME) {
+    cow_faults++;
+    tlb_clear_entry(vpage);
+    if (frame_map_count[shared] == 1) {
+      if (verbose) printf("Page %x is no longer shared, making page frame %x writable\n", vpage, shared);
+      pt_update_pagetable(vpage, shared);
+      tlb_insert(vpage, shared, mmu_get_mbit_bitmap_value(shared), FALSE);
+      return;
+    }
+  }
+
+  pframe = mmu_get_free_page_frame();
+  if (verbose) {
+    if (pframe != NO_FREE_PAGEFRAME) printf("Found free page frame: %x\n", pframe);
+    else printf("No free page frames, must evict a page\n");
+  }
+
+  while (pframe == NO_FREE_PAGEFRAME) {
+    evicted = evict_page();
+    tlb_clear_entry(inverse_page_table[evicted]);
+    evicted_page_count++;
+    if (verbose)
+      printf("Evicted page frame %x containing page %x\n", evicted, inverse_page_table[evicted]);
+    mmu_modify_pageframe_bitmap(evicted, 0);
+    // The old contents must be on their way to disk before the
+    // new page is read into the frame.
+    if (disk_write_queued(inverse_page_table[evicted])) disk_issue_writes();
+    pframe = mmu_get_free_page_frame();
+  }
+
+  // Unless the shared frame was the one evicted, the page is
+  // copied from it rather than read from disk.
+  if (shared != NO_FRAME && pt_lookup_pageframe(vpage) == shared) {
+    if (verbose) printf("Copying page %x from page frame %x to page frame %x\n", vpage, shared, pframe);
+    remove_shared_page(shared, vpage);
+    cow_copies++;
+  }
+  else if (fault_around_pages > 0) {
+    if (verbose) printf("Loading page %x from disk to page frame %x\n", vpage, pframe);
+    n = fault_around(vpage, pframe);
+    disk_read_pages(vpage, 1 + n);
+  }
+  else {
+    if (verbose) printf("Loading page %x from disk to page frame %x\n", vpage, pframe);
+    disk_read_page(vpage);
+  }
+  map_page(vpage, pframe);
+  tlb_insert(vpage, pframe, FALSE, FALSE);
+}
+
+// Drops the pages in the range from those sharing pframe, while
+// at least one is left.
+void unshare_range(PAGEFRAME_NUMBER pframe, VPAGE_NUMBER start, unsigned int count)
+{
+  SHARED_PAGE *page;
+  SHARED_PAGE *next;
+
+  for (page = shared_pages[pframe]; page != NULL; page = next) {
+    next = page->next;
+    if (page->vpage - start < count) remove_shared_page(pframe, page->vpage);
+  }
+  if (frame_map_count[pframe] > 1 && inverse_page_table[pframe] - start < count)
+    remove_shared_page(pframe, inverse_page_table[pframe]);
+}
+
+/* Unmaps count virtual pages starting at start, the way munmap
+   does: the contents are dropped, without being written back, and
+   the page frames holding them are freed, unless a page outside
+   the range still shares them. */
+void kernel_unmap_range(VPAGE_NUMBER start, unsigned int count)
+{
+  PAGEFRAME_NUMBER f;
+
+  tlb_clear_range(start, count);
+  for (f = 0; f < num_page_frames; f++) {
+    if (frame_map_count[f] > 1 && mmu_get_pageframe_bitmap_value(f)) unshare_range(f, start, count);
+    if (inverse_page_table[f] - start < count && mmu_get_pageframe_bitmap_value(f) &&
+        pt_lookup_pageframe(inverse_page_table[f]) == f) {
+      if (fault_around_pages > 0) retire_read_ahead(f);
+      mmu_modify_pageframe_bitmap(f, 0);
+      mmu_modify_mbit_bitmap(f, 0);
+      mmu_modify_rbit_bitmap(f, 0);
+    }
+  }
+  pt_clear_range(start, count);
+}
+
+/* Before the R bits are cleared, fold them into the per-frame
+   history that WSClock and aging keep. Frames in words with no
+   R bit set are skipped a word at a time. */
+void record_references()
+{
+  unsigned int w, bits;
+  PAGEFRAME_NUMBER f;
+
+  if (page_replacement == AGING_REPLACEMENT) {
+    for (f = 0; f < num_page_frames; f++) age_counter[f] = age_counter[f] >> 1;
+  }
+  for (w = 0; w < bitmap_size; w++) {
+    bits = rbit_bitmap[w] & valid_frame_bits(w);
+    while (bits) {
+      f = (w << int_size_shift) + __builtin_ctz(bits);
+      bits = bits & (bits - 1);
+      if (page_replacement == AGING_REPLACEMENT) age_counter[f] = age_counter[f] | 0x80;
+      else last_use_time[f] = virtual_time;
+    }
+  }
+}
+
+/* Starting at the clock hand, where the next victims come from,
+   queue writes for dirty pages that were not referenced since the
+   last clock interrupt and mark them clean, so evicting them later
+   does not stall on a write. */
+void clean_pages()
+{
+  PAGEFRAME_NUMBER f = start_evict_pageframe_search;
+  VPAGE_NUMBER vpage;
+  unsigned int cleaned = 0;
+
+  while (cleaned < cleaner_pages) {
+    f = find_frame(f, DIRTY_UNREFERENCED);
+    if (f == NO_FRAME) break;
+    if (mmu_get_pageframe_bitmap_value(f)) {
+      vpage = inverse_page_table[f];
+      if (verbose) printf("Cleaning page %x in pageframe %x\n", vpage, f);
+      // Drop the TLB entry first, or its M bit would be written
+      // back over the cleared one.
+      tlb_clear_entry(vpage);
+      mmu_modify_mbit_bitmap(f, 0);
+      disk_queue_write(vpage);
+      pages_cleaned++;
+      cleaned++;
+    }
+    else {
+      mmu_modify_mbit_bitmap(f, 0);
+    }
+  }
+}
+
+void handle_clock_interrupt()
+{
+  virtual_time++;
+  disk_advance_time(CLOCK_INTERRUPT_US);
+  pages_sharing_sum += pages_sharing;
+
+  // The TLB holds the most recent R and M bits.
+  if (page_replacement != CLOCK_REPLACEMENT || cleaner_pages > 0 || fault_around_pages > 0)
+    tlb_write_back();
+  if (page_replacement != CLOCK_REPLACEMENT) record_references();
+  if (fault_around_pages > 0) record_read_ahead_use();
+  if (cleaner_pages > 0) clean_pages();
+  if (disk_idle()) disk_issue_writes();
+
+  mmu_clear_rbits();
+
+  if (NUM_CPUS > 1) tlb_switch_cpu((current_cpu + 1) % NUM_CPUS);
+}
+
+/*************************************/
+/********* Snapshot support **********/
+/*************************************/
+
+void kernel_save_state(FILE *file)
+{
+  SHARED_PAGE *page;
+  PAGEFRAME_NUMBER f;
+
+  fwrite(&start_evict_pageframe_search, sizeof(PAGEFRAME_NUMBER), 1, file);
+  fwrite(&virtual_time, sizeof(virtual_time), 1, file);
+  fwrite(inverse_page_table, sizeof(VPAGE_NUMBER), num_page_frames, file);
+  fwrite(last_use_time, sizeof(unsigned int), num_page_frames, file);
+  fwrite(age_counter, sizeof(unsigned char), num_page_frames, file);
+  // The frames' map counts, then the pages in shared_pages.
+  fwrite(frame_map_count, sizeof(unsigned int), num_page_frames, file);
+  for (f = 0; f < num_page_frames; f++) {
+    for (page = shared_pages[f]; page != NULL; page = page->next)
+      fwrite(&page->vpage, sizeof(VPAGE_NUMBER), 1, file);
+  }
+}
+
+const char *kernel_restore_state(const char *state, const char *end)
+{
+  SHARED_PAGE **link;
+  SHARED_PAGE *page;
+  PAGEFRAME_NUMBER f;
+  unsigned int i;
+
+  state = snapshot_read(&start_evict_pageframe_search, state, end, sizeof(PAGEFRAME_NUMBER));
+  if (start_evict_pageframe_search >= num_page_frames) snapshot_corrupt();
+  state = snapshot_read(&virtual_time, state, end, sizeof(virtual_time));
+  state = snapshot_read(inverse_page_table, state, end, num_page_frames * sizeof(VPAGE_NUMBER));
+  for (f = 0; f < num_page_frames; f++) {
+    if (inverse_page_table[f] >= NUM_VPAGES) snapshot_corrupt();
+  }
+  state = snapshot_read(last_use_time, state, end, num_page_frames * sizeof(unsigned int));
+  state = snapshot_read(age_counter, state, end, num_page_frames * sizeof(unsigned char));
+  state = snapshot_read(frame_map_count, state, end, num_page_frames * sizeof(unsigned int));
+  for (f = 0; f < num_page_frames; f++) {
+    link = &shared_pages[f];
+    for (i = 1; i < frame_map_count[f]; i++) {
+      page = malloc(sizeof(SHARED_PAGE));
+      state = snapshot_read(&page->vpage, state, end, sizeof(VPAGE_NUMBER));
+      if (page->vpage >= NUM_VPAGES) snapshot_corrupt();
+      page->next = NULL;
+      *link = page;
+      link = &page->next;
+      pages_sharing++;
+    }
+  }
+  peak_pages_sharing = pages_sharing;
+  return state;
+}
+
+void issue_clock_interrupt()
+{
+  handle_clock_interrupt();
+}
@@ -3,7 +3,50 @@ void initialize_kernel();
 
 void issue_page_writeback(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe);
 
+// Called when the MMU issues a page fault trap for the vpage.
+void handle_page_fault_trap(VPAGE_NUMBER vpage);
+
+// Called by the CPU at every clock interrupt.
+void issue_clock_interrupt();
+
+#define CLOCK_REPLACEMENT    0  // NRU clock over the M and R bitmaps
+#define WSCLOCK_REPLACEMENT  1  // WSClock with a working-set window
+#define AGING_REPLACEMENT    2  // 8-bit aging counters
+
+/* A page referenced within the last WORKING_SET_WINDOW clock
+   interrupts is part of the working set and is not evicted by
+   WSClock while older pages exist. */
+#ifndef WORKING_SET_WINDOW
+  #define WORKING_SET_WINDOW 4
+#endif
+
+// The page frame replacement policy, PAGE_REPLACEMENT by default.
+// It can be changed while no page is mapped.
+extern int page_replacement;
+
+// Pages a page fault reads ahead at most, FAULT_AROUND_PAGES by
+// default; 0 turns fault-around off. It too can be changed while no
+// page is mapped.
+extern unsigned int fault_around_pages;
+
+// Dirty pages cleaned at each clock interrupt, CLEANER_PAGES by
+// default.
+extern unsigned int cleaner_pages;
+
+// Drops count virtual pages starting at start and frees their
+// page frames, as munmap would.
+void kernel_unmap_range(VPAGE_NUMBER start, unsigned int count);
+
+// Maps count virtual pages starting at to onto the page frames
+// holding those starting at from, copy-on-write, as fork would.
+void kernel_share_range(VPAGE_NUMBER from, VPAGE_NUMBER to, unsigned int count);
+
 extern unsigned int evicted_page_count;
 
 extern unsigned int evicted_page_written_to_disk_count;
 
+
+// Snapshot support: the clock hand, the inverse page table and
+// the per-frame replacement history.
+void kernel_save_state(FILE *file);
+const char *kernel_restore_state(const char *state, const char *end);
@@ -0,0 +1,366 @@
+/***********************************/
+/********** Kernel checks **********/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+/* Runs the kernel, the TLB and the page table without the CPU, on
+   a few pages and page frames, and checks what they do in cases
+   worked out by hand. Each check starts from an empty memory.
+   Exits with 1 on a failure. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "page.h"
+#include "tlb.h"
+#include "kernel.h"
+#include "disk.h"
+#include "profile.h"
+#include "timeseries.h"
+
+BOOL verbose = FALSE;
+
+unsigned int num_pages = 16;
+unsigned int num_pages_mod_mask = 15;
+unsigned int num_page_frames = 4;
+
+int page_fault_count;
+
+static BOOL page_fault_trap_issued;
+
+void issue_page_fault_trap(VPAGE_NUMBER vpage)
+{
+  page_fault_trap_issued = TRUE;
+  handle_page_fault_trap(vpage);
+}
+
+void access_page(VPAGE_NUMBER vpage, OPERATION op)
+{
+  mmu_translate(vpage << 12, op);
+  while (page_fault_trap_issued) {
+    page_fault_count++;
+    page_fault_trap_issued = FALSE;
+    mmu_translate(vpage << 12, op);
+  }
+}
+
+void check(BOOL ok, const char *what)
+{
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    exit(1);
+  }
+}
+
+// Unmaps every page, which frees every page frame.
+void clear_memory()
+{
+  kernel_unmap_range(0, num_pages);
+}
+
+// Loads new_page, which evicts a page, and checks that the page
+// evicted is victim.
+void check_evicts(VPAGE_NUMBER new_page, VPAGE_NUMBER victim, const char *what)
+{
+  access_page(new_page, LOAD);
+  check(pt_lookup_pageframe(victim) == -1, what);
+}
+
+
+/*************************************/
+/***** Page replacement policies *****/
+/*************************************/
+
+// With 4 frames, pages referenced at different ages, and no ties,
+// the order of evictions does not depend on the clock hand. Pages
+// 1 to 4 go into frames in that order, and are evicted in the
+// opposite one, so a search that just follows the hand fails.
+
+// WSClock evicts a clean page outside the working set first, then a
+// dirty one, then a clean page inside it, then a dirty one.
+void check_wsclock_order()
+{
+  int policy = page_replacement;
+  unsigned int evicted;
+  int tick;
+
+  clear_memory();
+  page_replacement = WSCLOCK_REPLACEMENT;
+  access_page(1, STORE);
+  access_page(2, LOAD);
+  access_page(3, STORE);
+  access_page(4, LOAD);
+  issue_clock_interrupt();
+  // Pages 3 and 4 leave the working set; 1 and 2 stay in it.
+  for (tick = 0; tick <= WORKING_SET_WINDOW; tick++) {
+    access_page(1, LOAD);
+    access_page(2, LOAD);
+    issue_clock_interrupt();
+  }
+
+  evicted = evicted_page_written_to_disk_count;
+  check_evicts(5, 4, "WSClock evicts the old clean page first");
+  check(evicted_page_written_to_disk_count == evicted, "the old clean page is not written back");
+  check_evicts(6, 3, "WSClock evicts the old dirty page next");
+  check(evicted_page_written_to_disk_count == evicted + 1, "the old dirty page is written back");
+  check_evicts(7, 2, "WSClock then evicts the young clean page");
+  check_evicts(8, 1, "WSClock evicts the young dirty page last");
+  clear_memory();
+  page_replacement = policy;
+}
+
+// Aging evicts the page referenced least recently, counted in
+// clock interrupts, and of two pages as old, the clean one.
+void check_aging_order()
+{
+  int policy = page_replacement;
+
+  clear_memory();
+  page_replacement = AGING_REPLACEMENT;
+  access_page(1, STORE);
+  access_page(2, LOAD);
+  access_page(3, LOAD);
+  access_page(4, LOAD);
+  issue_clock_interrupt();
+  access_page(1, LOAD);
+  access_page(2, LOAD);
+  access_page(3, LOAD);
+  issue_clock_interrupt();
+  access_page(1, LOAD);
+  access_page(2, LOAD);
+  issue_clock_interrupt();
+  // Counters: page 4 0x20, page 3 0x60, pages 1 (dirty) and 2 0xE0.
+
+  check_evicts(5, 4, "aging evicts the page not referenced for longest");
+  check_evicts(6, 3, "aging evicts the next oldest page");
+  check_evicts(7, 2, "aging evicts the clean page of two as old");
+  check_evicts(8, 1, "aging evicts the dirty page last");
+  clear_memory();
+  page_replacement = policy;
+}
+
+
+/*************************************/
+/*********** Copy-on-write ***********/
+/*************************************/
+
+// A STORE to a shared page copies it, and the page it was shared
+// with keeps the frame; once that is the only page mapping the
+// frame, a STORE makes it writable where it is.
+void check_copy_on_write()
+{
+  PAGEFRAME_NUMBER f;
+
+  clear_memory();
+  access_page(1, STORE);
+  f = pt_lookup_pageframe(1);
+  kernel_share_range(1, 9, 1);
+
+  access_page(9, STORE);
+  check(pt_lookup_pageframe(9) != f && pt_lookup_pageframe(9) != -1, "a STORE to page 9 gives it a frame of its own");
+  check(!pt_is_read_only(9), "page 9 is writable after its copy");
+  check(pt_lookup_pageframe(1) == f && pt_is_read_only(1), "page 1 keeps the shared frame, read-only");
+
+  access_page(1, STORE);
+  check(pt_lookup_pageframe(1) == f, "page 1 is not copied once nothing else maps its frame");
+  check(!pt_is_read_only(1), "page 1 is writable again");
+}
+
+// Unmapping one of two pages sharing a frame leaves the other
+// mapping it, no longer shared; unmapping that one frees the frame.
+void check_unmap_shared()
+{
+  PAGEFRAME_NUMBER f;
+
+  clear_memory();
+  access_page(2, LOAD);
+  f = pt_lookup_pageframe(2);
+  kernel_share_range(2, 10, 1);
+
+  kernel_unmap_range(10, 1);
+  check(pt_lookup_pageframe(10) == -1, "page 10 is unmapped");
+  check(pt_lookup_pageframe(2) == f && mmu_get_pageframe_bitmap_value(f), "page 2 still maps its frame");
+  access_page(2, STORE);
+  check(pt_lookup_pageframe(2) == f && !pt_is_read_only(2), "page 2 is made writable in place");
+
+  kernel_unmap_range(2, 1);
+  check(pt_lookup_pageframe(2) == -1, "page 2 is unmapped");
+  check(!mmu_get_pageframe_bitmap_value(f), "the frame is free once no page maps it");
+}
+
+// A page stored to before a fork, while its M bit was still only
+// in the TLB, is written back when its shared frame is evicted.
+void check_fork_write_back()
+{
+  unsigned int written_back;
+  VPAGE_NUMBER v;
+  int round;
+
+  clear_memory();
+  // Page 0 is dirty, but only its TLB entry knows.
+  access_page(0, STORE);
+  kernel_share_range(0, 8, 1);
+  check(pt_is_read_only(0) && pt_is_read_only(8), "pages 0 and 8 are read-only after the fork");
+  check(pt_lookup_pageframe(0) == pt_lookup_pageframe(8), "pages 0 and 8 share a frame");
+
+  // Loading other pages evicts the shared frame: page 8 is always
+  // written back, and page 0 has to be as well, since it is dirty.
+  written_back = evicted_page_written_to_disk_count;
+  for (round = 0; round < 4 && pt_lookup_pageframe(0) != -1; round++) {
+    for (v = 1; v < 8; v++) access_page(v, LOAD);
+    issue_clock_interrupt();
+  }
+  check(pt_lookup_pageframe(0) == -1 && pt_lookup_pageframe(8) == -1, "the shared frame was evicted");
+  check(evicted_page_written_to_disk_count - written_back == 2, "both sharers of the dirty frame were written back");
+}
+
+
+/*************************************/
+/*********** Fault-around ************/
+/*************************************/
+
+// With a window of up to 2 pages: a fault just past the pages of
+// the previous one maps the pages after it as well, one, then two,
+// and unmapping two of them unreferenced halves the window twice.
+void check_fault_around()
+{
+  clear_memory();
+  fault_around_pages = 2;
+
+  access_page(1, LOAD);
+  check(pt_lookup_pageframe(2) == -1, "a first fault reads nothing ahead");
+  access_page(2, LOAD);
+  check(pt_lookup_pageframe(3) != -1, "the next fault reads one page ahead");
+  check(pt_lookup_pageframe(4) == -1, "the next fault reads only one page ahead");
+
+  // Page 3 is used, so the window does not shrink.
+  access_page(3, LOAD);
+  kernel_unmap_range(1, 3);
+  access_page(4, LOAD);
+  check(pt_lookup_pageframe(5) != -1 && pt_lookup_pageframe(6) != -1, "the window doubles to two pages");
+  check(pt_lookup_pageframe(7) == -1, "the window is two pages, no more");
+
+  // Pages 5 and 6 are not, so it goes down to none, and grows back
+  // to one at the next fault.
+  kernel_unmap_range(4, 3);
+  access_page(7, LOAD);
+  check(pt_lookup_pageframe(8) != -1, "a fault after the window shrank reads one page ahead");
+  check(pt_lookup_pageframe(9) == -1, "pages read ahead and not used shrink the window");
+
+  clear_memory();
+  fault_around_pages = 0;
+}
+
+
+/*************************************/
+/************ Paging disk ************/
+/*************************************/
+
+// A dirty page evicted and faulted straight back in is read only
+// after its write has gone to the disk, as is any page in a read of
+// several pages.
+void check_read_after_write_back()
+{
+  VPAGE_NUMBER v;
+  int round;
+
+  clear_memory();
+  access_page(1, STORE);
+  for (round = 0; round < 4 && pt_lookup_pageframe(1) != -1; round++) {
+    for (v = 2; v < 7; v++) access_page(v, LOAD);
+    issue_clock_interrupt();
+  }
+  check(pt_lookup_pageframe(1) == -1, "page 1 was evicted");
+  access_page(1, LOAD);
+  check(!disk_write_queued(1), "page 1 was written back before it was read");
+
+  disk_queue_write(12);
+  disk_read_pages(11, 3);
+  check(!disk_write_queued(12), "a read of pages 11 to 13 waits for the write of page 12");
+}
+
+/*************************************/
+/********* Hot page profile **********/
+/*************************************/
+
+#define TRACE_PAGES 8192
+#define TRACE_EVENTS 100000
+
+// On a trace of more pages than the sketch has counters in a row,
+// half of its events on 16 hot pages, no page's estimate is below
+// its true count.
+void check_profile_estimates()
+{
+  static unsigned int true_count[TRACE_PAGES];
+  unsigned int seed = 1;
+  unsigned int i, n;
+
+  for (i = 0; i < TRACE_EVENTS; i++) {
+    seed = seed * 1103515245 + 12345;
+    n = (seed >> 8) % TRACE_PAGES;
+    if (seed >> 31) n = n % 16;
+    true_count[n]++;
+    profile_page_fault(n * 127);
+  }
+  for (n = 0; n < TRACE_PAGES; n++)
+    check(profile_page_faults(n * 127) >= true_count[n], "no page fault count is underestimated");
+}
+
+/*************************************/
+/************ Time series ************/
+/*************************************/
+
+// Sampling every 10 instructions, the buffer fills up at
+// TIMESERIES_SAMPLES samples, and again after as many instructions
+// once halved. By 3 times that, the samples are every 40
+// instructions, from the first interval on, and the last one is at
+// the end of the run.
+void check_timeseries_halving()
+{
+  unsigned int instructions = 3 * TIMESERIES_SAMPLES * 10 + 10;
+  unsigned int spacing = 40;
+  unsigned int n;
+  unsigned int i;
+
+  setenv("TIMESERIES_SAVE", "/dev/null", 1);
+  setenv("TIMESERIES_EVERY", "10", 1);
+  timeseries_initialize();
+  for (i = 0; i != instructions; i++) {
+    if (i + 1 == timeseries_next_sample) timeseries_sample(i + 1);
+  }
+  timeseries_finish(instructions);
+
+  n = timeseries_num_samples();
+  check(n == (instructions - 10) / spacing + 1, "halving keeps half the samples each time");
+  for (i = 0; i + 1 < n; i++) {
+    if (timeseries_sample_instructions(i) != (i + 1) * spacing)
+      check(FALSE, "the samples kept are evenly spaced");
+  }
+  check(timeseries_sample_instructions(n - 1) == instructions, "the last sample is at the end of the run");
+}
+
+int main()
+{
+  num_tlb_entries = 4;
+  initialize_kernel();
+  mmu_initialize();
+  // Only check_fault_around turns fault-around on, and the cleaner
+  // would make the dirty pages of the replacement checks clean.
+  fault_around_pages = 0;
+  cleaner_pages = 0;
+
+  check_wsclock_order();
+  check_aging_order();
+  check_fault_around();
+  check_copy_on_write();
+  check_unmap_shared();
+  check_fork_write_back();
+  check_read_after_write_back();
+  check_profile_estimates();
+  check_timeseries_halving();
+
+  printf("kernel_test passed\n");
+  return 0;
+}
@@ -27,6 +27,14 @@
 
 void mmu_initialize();
 
+// The bitmaps themselves, bitmap_size words each. Page frame i
+// is bit (i % 32) of word (i / 32). The kernel reads them a
+// word at a time when looking for a page to evict.
+extern unsigned int *rbit_bitmap;
+extern unsigned int *mbit_bitmap;
+extern unsigned int *pageframe_bitmap;
+extern unsigned int bitmap_size;
+
 // This sets the bit in the R bit bitmap corresponding
 // to the specified page frame to the specified value (0 or 1)
 void mmu_modify_rbit_bitmap(PAGEFRAME_NUMBER pframe, int val);
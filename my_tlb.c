@@ -5,10 +5,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "types.h"
 #include "tlb.h"
 #include "cpu.h"
 #include "mmu.h"
+#include "page.h"
+#include "snapshot.h"
+#include "profile.h"
 
 /* Set this to 1 to print out debug statements */
 #define DEBUG 0
@@ -23,12 +27,67 @@
 
 #define ASSERT(result, name) {if(!result) {SAY1("Assertion %s failed.\n", name); exit(0);}}
 
+/* Maximum number of contiguous virtual pages a single TLB entry
+   may map. 1 disables coalescing. Set to 8 or 16 so tlb_insert
+   merges a vpage with its neighbors whenever the page table maps
+   them to consecutive page frames. */
+#ifndef TLB_COALESCE_PAGES
+  #define TLB_COALESCE_PAGES 1
+#endif
+
+/* A run is kept inside an aligned block of TLB_COALESCE_PAGES
+   pages, and its length minus one fits in the 4-bit span field. */
+#if TLB_COALESCE_PAGES < 1 || (TLB_COALESCE_PAGES & (TLB_COALESCE_PAGES - 1)) != 0
+  #error "TLB_COALESCE_PAGES must be a power of two"
+#endif
+#if TLB_COALESCE_PAGES > 16
+  #error "TLB_COALESCE_PAGES must be at most 16"
+#endif
+
+/* Shootdowns a CPU can have pending before the sender has to
+   interrupt it and wait for the queue to be drained. */
+#ifndef SHOOTDOWN_BATCH
+  #define SHOOTDOWN_BATCH 32
+#endif
+
+/* Modeled cost, in nanoseconds, of interrupting another CPU and
+   waiting for it to acknowledge, and of each invalidation it then
+   performs. */
+#ifndef SHOOTDOWN_IPI_NS
+  #define SHOOTDOWN_IPI_NS 2000
+#endif
+#ifndef SHOOTDOWN_ENTRY_NS
+  #define SHOOTDOWN_ENTRY_NS 100
+#endif
+
+/* Number of recent translations (0 to 4) that tlb_lookup checks
+   before searching the TLB. 0 turns this micro-TLB off. */
+#ifndef MICRO_TLB_ENTRIES
+  #define MICRO_TLB_ENTRIES 2
+#endif
+
+/* tlb_clear_range looks up each page of a range of up to this
+   many pages; a longer range is cleared in one pass over the TLB. */
+#ifndef TLB_RANGE_SCAN_PAGES
+  #define TLB_RANGE_SCAN_PAGES 8
+#endif
+
+/* Set to 1 to always use the loops sized by num_tlb_entries, even
+   when an engine specialized for the TLB size exists. Useful for
+   timing the specialized engines against the generic one. */
+#ifndef TLB_GENERIC_ENGINE
+  #define TLB_GENERIC_ENGINE 0
+#endif
+
 //You can use a struct to get a two-word entry.
+//The first word of each entry (valid bit, span and 20-bit virtual
+//page number) is kept apart, in tlb_tags, so that searching the
+//TLB reads only the tags, packed next to each other.
 typedef struct {
-  unsigned int vbit_and_vpage;  // 32 bits containing the valid bit and the 20bit
-                                // virtual page number.
   unsigned int mr_pframe;       // 32 bits containing the modified bit, reference bit,
-                                // and 20-bit page frame number
+                                // read-only bit and 20-bit page frame number
+  unsigned int span_mr_bits;    // per-page R bits (low 16) and M bits (high 16)
+                                // of an entry covering more than one page
 } TLB_ENTRY;
 
 
@@ -37,6 +96,14 @@ typedef struct {
 // assigned when the simulation started running.
 
 TLB_ENTRY *tlb;  
+unsigned int *tlb_tags;
+
+// tlb and tlb_tags always point at the TLB of the running CPU.
+// These hold the TLB of every CPU.
+TLB_ENTRY *cpu_tlb[NUM_CPUS];
+unsigned int *cpu_tlb_tags[NUM_CPUS];
+int cpu_clock_hand[NUM_CPUS];
+int current_cpu = 0;
 
 // This is the TLB size (number of TLB entries) chosen by the 
 // user. 
@@ -60,7 +127,11 @@ BOOL tlb_miss;
 #define VPAGE_MASK  0x000FFFFF            //lowest 20 bits of first word
 #define RBIT_MASK   0x80000000  //RIT is leftmost bit of second word
 #define MBIT_MASK   0x40000000  //MBIT is second leftmost bit of second word
+#define ROBIT_MASK  0x20000000  //read-only bit is third leftmost bit of second word
 #define PFRAME_MASK 0x000FFFFF            //lowest 20 bits of second word
+#define SPAN_MASK   0x00F00000  //number of pages mapped, minus one, in first word
+#define SPAN_RBITS_MASK 0x0000FFFF        //lowest 16 bits of third word
+#define SPAN_MBITS_SHIFT 16               //M bits are the upper 16 bits of third word
 
 
 /*************************************/
@@ -69,16 +140,21 @@ BOOL tlb_miss;
 
 #define LAST_BIT_OFFSET 31      //Used for R bit and Vbit
 #define M_BIT_OFFSET 30
+#define SPAN_OFFSET 20
 
 /*************************************/
 /***** Use masks to get values *******/
 /*************************************/
 
-#define get_vpage_number(i) (tlb[i].vbit_and_vpage & VPAGE_MASK)
+#define get_vpage_number(i) (tlb_tags[i] & VPAGE_MASK)
 #define get_pageframe_number(i) (tlb[i].mr_pframe & PFRAME_MASK)
-#define get_valid_bit(i) ((tlb[i].vbit_and_vpage & VBIT_MASK) >> LAST_BIT_OFFSET)
+#define get_valid_bit(i) ((tlb_tags[i] & VBIT_MASK) >> LAST_BIT_OFFSET)
 #define get_r_bit(i) ((tlb[i].mr_pframe & RBIT_MASK) >> LAST_BIT_OFFSET)
 #define get_m_bit(i) ((tlb[i].mr_pframe & MBIT_MASK) >> M_BIT_OFFSET)
+#define get_read_only_bit(i) ((tlb[i].mr_pframe & ROBIT_MASK) != 0)
+#define get_span(i) (((tlb_tags[i] & SPAN_MASK) >> SPAN_OFFSET) + 1)
+#define get_span_r_bit(i, k) ((tlb[i].span_mr_bits >> (k)) & 1)
+#define get_span_m_bit(i, k) ((tlb[i].span_mr_bits >> (SPAN_MBITS_SHIFT + (k))) & 1)
 
 
 /*************************************/
@@ -96,12 +172,25 @@ void set_foo_bit(int i, BOOL value, int mask){
 
 #define set_r_bit(i, r_bit)(set_foo_bit(i, r_bit, RBIT_MASK))
 #define set_m_bit(i, m_bit)(set_foo_bit(i, m_bit, MBIT_MASK))
-#define set_valid_bit(i) (tlb[i].vbit_and_vpage = tlb[i].vbit_and_vpage | VBIT_MASK)
+#define set_read_only_bit(i, ro_bit)(set_foo_bit(i, ro_bit, ROBIT_MASK))
+#define set_valid_bit(i) (tlb_tags[i] = tlb_tags[i] | VBIT_MASK)
 
 void set_vpage(int i, VPAGE_NUMBER vpage){
   unsigned int masked_vpage = vpage & VPAGE_MASK;
-  tlb[i].vbit_and_vpage = tlb[i].vbit_and_vpage & ~VPAGE_MASK;
-  tlb[i].vbit_and_vpage = tlb[i].vbit_and_vpage | masked_vpage;
+  tlb_tags[i] = tlb_tags[i] & ~VPAGE_MASK;
+  tlb_tags[i] = tlb_tags[i] | masked_vpage;
+}
+
+void set_span(int i, unsigned int span){
+  tlb_tags[i] = tlb_tags[i] & ~SPAN_MASK;
+  tlb_tags[i] = tlb_tags[i] | (((span - 1) << SPAN_OFFSET) & SPAN_MASK);
+}
+
+/* Records a reference (and, for a STORE, a modification) of the
+   k'th page of a coalesced entry. */
+void set_span_bits(int i, unsigned int k, BOOL m_bit){
+  tlb[i].span_mr_bits = tlb[i].span_mr_bits | (1 << k);
+  if (m_bit) tlb[i].span_mr_bits = tlb[i].span_mr_bits | (1 << (SPAN_MBITS_SHIFT + k));
 }
 
 void set_pageframe(int i, PAGEFRAME_NUMBER pf_number){
@@ -112,13 +201,14 @@ void set_pageframe(int i, PAGEFRAME_NUMBER pf_number){
 
 void clear_valid_bit(int i){
   if(get_valid_bit(i)){
-    tlb[i].vbit_and_vpage = tlb[i].vbit_and_vpage & ~VBIT_MASK;
+    tlb_tags[i] = tlb_tags[i] & ~VBIT_MASK;
   }
 }
 
 void clear_r_bit(int i){
   if(get_valid_bit(i)){
     tlb[i].mr_pframe = tlb[i].mr_pframe & ~RBIT_MASK;
+    tlb[i].span_mr_bits = tlb[i].span_mr_bits & ~SPAN_RBITS_MASK;
   }
 }
 
@@ -126,45 +216,164 @@ void clear_r_bit(int i){
 /***** Print data for debugging ******/
 /*************************************/
 
-void print_entry(int i){
+void print_tlb_entry(int i){
   SAY1("%x        ",i);
   SAY1("%x          ",get_valid_bit(i));
   SAY1("%x       ",get_vpage_number(i));
   SAY1("%x         ",get_m_bit(i));
   SAY1("%x         ",get_r_bit(i));
   SAY1("%x          ",get_pageframe_number(i));
+  SAY1("%x          ",get_span(i));
   SAY("\n");
 }
 
-void print_table(){
+void print_tlb_table(){
   SAY("---------------   PRINTING TABLE   ------------------\n");
   SAY("-----------------------------------------------------\n");
-  SAY("PID --- VALID --- VP_NO --- MOD --- REF --- PF_NO ---\n");
+  SAY("PID --- VALID --- VP_NO --- MOD --- REF --- PF_NO --- SPAN ---\n");
   int i = 0;
   for (i = 0; i< num_tlb_entries; i++){
-    if (get_valid_bit(i)) print_entry(i);
+    if (get_valid_bit(i)) print_tlb_entry(i);
   }
   SAY("-----------------------------------------------------\n");
 }
 
 
+/*************************************/
+/********* Specialized engines *******/
+/*************************************/
+
+/* TRUE if entry i translates vpage. Without coalescing, the valid
+   bit and the vpage number are checked with a single compare. */
+#if TLB_COALESCE_PAGES > 1
+  #define entry_matches(i, vpage) \
+    (get_valid_bit(i) && (vpage) - get_vpage_number(i) < get_span(i))
+#else
+  #define entry_matches(i, vpage) \
+    ((tlb_tags[i] & (VBIT_MASK | VPAGE_MASK)) == (VBIT_MASK | (vpage)))
+#endif
+
+/* The loops that walk the whole TLB, with the number of entries
+   known at compile time so the compiler can unroll them. A vpage
+   is in at most one entry, so the search tests a block of
+   TLB_SEARCH_BLOCK entries without branches and only then checks
+   whether to stop. */
+#define TLB_SEARCH_BLOCK 8
+
+#define DEFINE_TLB_ENGINE(N)                                  \
+  int find_by_vpage_number_##N(VPAGE_NUMBER vpage){           \
+    int block, i;                                             \
+    unsigned int hits;                                        \
+    for (block = 0; block < N; block += TLB_SEARCH_BLOCK){    \
+      hits = 0;                                               \
+      for (i = 0; i < TLB_SEARCH_BLOCK; i++){                 \
+        hits = hits | (entry_matches(block + i, vpage) << i); \
+      }                                                       \
+      if (hits) return block + __builtin_ctz(hits);           \
+    }                                                         \
+    return -1;                                                \
+  }                                                           \
+  void clear_all_##N(){                                       \
+    int i;                                                    \
+    for (i = 0; i < N; i++){                                  \
+      tlb_tags[i] = tlb_tags[i] & ~VBIT_MASK; \
+    }                                                         \
+  }                                                           \
+  void clear_all_R_bits_##N(){                                \
+    int i;                                                    \
+    for (i = 0; i < N; i++){                                  \
+      tlb[i].mr_pframe = tlb[i].mr_pframe & ~RBIT_MASK;       \
+      tlb[i].span_mr_bits = tlb[i].span_mr_bits & ~SPAN_RBITS_MASK; \
+    }                                                         \
+  }
+
+DEFINE_TLB_ENGINE(16)
+DEFINE_TLB_ENGINE(32)
+DEFINE_TLB_ENGINE(64)
+DEFINE_TLB_ENGINE(128)
+DEFINE_TLB_ENGINE(256)
+DEFINE_TLB_ENGINE(512)
+DEFINE_TLB_ENGINE(1024)
+DEFINE_TLB_ENGINE(2048)
+DEFINE_TLB_ENGINE(4096)
+
+int find_by_vpage_number_generic(VPAGE_NUMBER vpage);
+void clear_all_generic();
+void clear_all_R_bits_generic();
+
+typedef struct {
+  unsigned int num_entries;
+  int (*find_by_vpage_number)(VPAGE_NUMBER vpage);
+  void (*clear_all)();
+  void (*clear_all_R_bits)();
+} TLB_ENGINE;
+
+#define TLB_ENGINE_FOR(N) {N, find_by_vpage_number_##N, clear_all_##N, clear_all_R_bits_##N}
+
+TLB_ENGINE specialized_engines[] = {
+  TLB_ENGINE_FOR(16), TLB_ENGINE_FOR(32), TLB_ENGINE_FOR(64),
+  TLB_ENGINE_FOR(128), TLB_ENGINE_FOR(256), TLB_ENGINE_FOR(512),
+  TLB_ENGINE_FOR(1024), TLB_ENGINE_FOR(2048), TLB_ENGINE_FOR(4096)
+};
+
+TLB_ENGINE generic_engine = {0, find_by_vpage_number_generic,
+                             clear_all_generic, clear_all_R_bits_generic};
+
+// The engine in use, picked once from num_tlb_entries.
+TLB_ENGINE tlb_engine;
+
+void select_tlb_engine(){
+  int i;
+  tlb_engine = generic_engine;
+  if (TLB_GENERIC_ENGINE) return;
+  for (i = 0; i < sizeof(specialized_engines) / sizeof(TLB_ENGINE); i++){
+    if (specialized_engines[i].num_entries == num_tlb_entries){
+      tlb_engine = specialized_engines[i];
+    }
+  }
+}
+
+
 // Initialize the TLB (called by the mmu)
 void tlb_initialize()
 {
+  int cpu;
+
   //Here's how you can allocate a TLB of the right size
-  tlb = (TLB_ENTRY *) malloc(num_tlb_entries * sizeof(TLB_ENTRY));
+  for (cpu = 0; cpu < NUM_CPUS; cpu++){
+    cpu_tlb[cpu] = (TLB_ENTRY *) malloc(num_tlb_entries * sizeof(TLB_ENTRY));
+    cpu_tlb_tags[cpu] = (unsigned int *) malloc(num_tlb_entries * sizeof(unsigned int));
+    cpu_clock_hand[cpu] = 0;
+  }
+  tlb = cpu_tlb[0];
+  tlb_tags = cpu_tlb_tags[0];
 
   //This is the mask to perform a MOD operation (see above)
   mod_tlb_entries_mask = num_tlb_entries - 1;  
 
+  select_tlb_engine();
+
   //Fill in rest here...
   tlb_clear_all();
 }
 
 
+void load_cpu_tlb(int cpu);
+
 // This clears out the entire TLB, by clearing the
-// valid bit for every entry.
+// valid bit for every entry, on every CPU.
 void tlb_clear_all() 
+{
+  int running = current_cpu;
+  int cpu;
+  for (cpu = 0; cpu < NUM_CPUS; cpu++){
+    load_cpu_tlb(cpu);
+    tlb_engine.clear_all();
+  }
+  load_cpu_tlb(running);
+}
+
+void clear_all_generic()
 {
   int i;
   for (i = 0; i<num_tlb_entries; i++){
@@ -173,34 +382,162 @@ void tlb_clear_all()
 }
 
 
-//clears all the R bits in the TLB
+//clears all the R bits in the TLB of every CPU
 void tlb_clear_all_R_bits()
+{
+  int running = current_cpu;
+  int cpu;
+  for (cpu = 0; cpu < NUM_CPUS; cpu++){
+    load_cpu_tlb(cpu);
+    tlb_engine.clear_all_R_bits();
+  }
+  load_cpu_tlb(running);
+}
+
+void clear_all_R_bits_generic()
 {
   int i;
-  for (i = 0; i<num_tlb_entries+1; i++){
+  for (i = 0; i<num_tlb_entries; i++){
     clear_r_bit(i);
   }
 }
 
+/* Writes the M and R bits of entry i back to the MMU bitmaps,
+   one page frame at a time for a coalesced entry. */
+/* With several CPUs a page can be in more than one TLB, and a TLB
+   that never touched a page must not clear the bits another CPU set.
+   So the bits are only ever set then; they are cleared by the kernel. */
+void write_bits_to_mmu(PAGEFRAME_NUMBER pf, BOOL m_bit, BOOL r_bit){
+  if (NUM_CPUS > 1){
+    if (m_bit) mmu_modify_mbit_bitmap(pf, 1);
+    if (r_bit) mmu_modify_rbit_bitmap(pf, 1);
+    return;
+  }
+  mmu_modify_mbit_bitmap(pf, m_bit);
+  mmu_modify_rbit_bitmap(pf, r_bit);
+}
+
+void write_entry_to_mmu(int i){
+  unsigned int span = get_span(i);
+  unsigned int k;
+  if (span == 1){
+    write_bits_to_mmu(get_pageframe_number(i), get_m_bit(i), get_r_bit(i));
+    return;
+  }
+  for (k = 0; k < span; k++){
+    write_bits_to_mmu(get_pageframe_number(i) + k, get_span_m_bit(i, k), get_span_r_bit(i, k));
+  }
+}
+
+int find_by_vpage_number(VPAGE_NUMBER vpage);
+void post_shootdowns(VPAGE_NUMBER start, unsigned int count);
+
+/*
+ * Drops every entry mapping a page in [start, start + count) and
+ * returns how many were dropped. With write_back set, the M and R
+ * bits of each entry dropped (all the pages of a coalesced one) are
+ * written back first, so a page modified only in the TLB stays dirty.
+ */
+int clear_range(VPAGE_NUMBER start, unsigned int count, BOOL write_back){
+  int cleared = 0;
+  unsigned int n;
+  int i;
+
+  if (count <= TLB_RANGE_SCAN_PAGES){
+    for (n = 0; n < count; n++){
+      i = find_by_vpage_number(start + n);
+      if (i < 0) continue;
+      if (write_back) write_entry_to_mmu(i);
+      clear_valid_bit(i);
+      cleared++;
+    }
+    return cleared;
+  }
+  for (i = 0; i < num_tlb_entries; i++){
+    if (get_valid_bit(i) &&
+        (get_vpage_number(i) - start < count || start - get_vpage_number(i) < get_span(i))){
+      if (write_back) write_entry_to_mmu(i);
+      clear_valid_bit(i);
+      cleared++;
+    }
+  }
+  return cleared;
+}
+
 // This clears out the entry in the TLB for the specified
 // virtual page, by clearing the valid bit for that entry.
 void tlb_clear_entry(VPAGE_NUMBER vpage) {
-  int i = find_by_vpage_number(vpage);
-  clear_valid_bit(i);
+  tlb_clear_range(vpage, 1);
+}
+
+// Clears the entries for count virtual pages starting at start.
+// The other CPUs are sent a shootdown for the range.
+void tlb_clear_range(VPAGE_NUMBER start, unsigned int count) {
+  if (NUM_CPUS > 1) post_shootdowns(start, count);
+  clear_range(start, count, TRUE);
 }
 
 
 int find_by_vpage_number(VPAGE_NUMBER vpage){
+  return tlb_engine.find_by_vpage_number(vpage);
+}
+
+/* An entry matches every vpage in [vpage number, vpage number + span). */
+int find_by_vpage_number_generic(VPAGE_NUMBER vpage){
   int i;
   for (i = 0; i < num_tlb_entries; i++){
     if(get_valid_bit(i)){
-      if (get_vpage_number(i) == vpage) return i;
+      if (vpage - get_vpage_number(i) < get_span(i)) return i;
     }
   }
   return -1; //impossible index returned when entry not found
 }
 
 
+/*
+ * The micro-TLB remembers the TLB slots of the last few vpages
+ * translated. An entry is only used while its slot still maps the
+ * vpage, so clearing or replacing TLB entries (or switching CPUs)
+ * makes it miss without having to be invalidated.
+ */
+#define MICRO_TLB_SIZE (MICRO_TLB_ENTRIES > 0 ? MICRO_TLB_ENTRIES : 1)
+
+VPAGE_NUMBER micro_tlb_vpage[MICRO_TLB_SIZE];
+int micro_tlb_slot[MICRO_TLB_SIZE];
+int micro_tlb_next = 0;
+
+unsigned int tlb_lookups = 0;
+unsigned int micro_tlb_hits = 0;
+
+// A STORE to a read-only (copy-on-write) page. The MMU only asks
+// the page table for the page frame, not whether the access may
+// write it, so the TLB raises the page fault itself, as the MMU
+// does for a missing page. The CPU retries the access once the
+// trap returns, so this reports a hit on the page frame the kernel
+// gave the page, and the MMU neither walks the page table nor
+// inserts a second entry for it.
+PAGEFRAME_NUMBER raise_write_fault(VPAGE_NUMBER vpage)
+{
+  tlb_write_back();
+  issue_page_fault_trap(vpage);
+  tlb_miss = FALSE;
+  return pt_lookup_pageframe(vpage);
+}
+
+// Sets the R bit (and M bit for a STORE) of entry i, which maps
+// vpage, and returns the page frame. A STORE to a read-only page
+// raises a page fault instead.
+PAGEFRAME_NUMBER tlb_hit(int i, VPAGE_NUMBER vpage, OPERATION op)
+{
+  unsigned int k = vpage - get_vpage_number(i);
+  if (op == STORE && get_read_only_bit(i)) return raise_write_fault(vpage);
+  tlb_miss = FALSE;
+  set_r_bit(i,TRUE);
+  if (op == STORE) set_m_bit(i,TRUE);
+  if (get_span(i) > 1) set_span_bits(i, k, op == STORE);
+  return get_pageframe_number(i) + k;
+}
+
 // Returns a page frame number if there is a TLB hit. If there is a TLB
 // miss, then it sets tlb_miss (see above) to TRUE.  It sets the R
 // bit of the entry and, if the specified operation is a STORE,
@@ -208,16 +545,35 @@ int find_by_vpage_number(VPAGE_NUMBER vpage){
 
 PAGEFRAME_NUMBER tlb_lookup(VPAGE_NUMBER vpage, OPERATION op)
 {
+  int n;
+
+  // mmu_initialize clears the bitmaps after setting up the TLB and
+  // the page table, so a snapshot is loaded on the first lookup.
+  if (snapshot_restore_pending) snapshot_restore();
+
+  tlb_lookups++;
+  for (n = 0; n < MICRO_TLB_ENTRIES; n++){
+    if (micro_tlb_vpage[n] == vpage && entry_matches(micro_tlb_slot[n], vpage)){
+      micro_tlb_hits++;
+      return tlb_hit(micro_tlb_slot[n], vpage, op);
+    }
+  }
+
   int i = find_by_vpage_number(vpage);
 
   // Check if the index is within bounds. A value of -1 means that the tlb entry
   // could not be located.
   if (i >= 0){
-    tlb_miss = FALSE;
-    set_r_bit(i,TRUE);
-    if (op == STORE) set_m_bit(i,TRUE);
-    return get_pageframe_number(i);
+    if (MICRO_TLB_ENTRIES > 0){
+      micro_tlb_vpage[micro_tlb_next] = vpage;
+      micro_tlb_slot[micro_tlb_next] = i;
+      micro_tlb_next = (micro_tlb_next + 1) % MICRO_TLB_SIZE;
+    }
+    return tlb_hit(i, vpage, op);
   }
+  // Not a miss: the MMU does not count it, so the profiler doesn't.
+  if (op == STORE && pt_is_read_only(vpage)) return raise_write_fault(vpage);
+  if (HOT_PAGE_PROFILE) profile_tlb_miss(vpage);
   tlb_miss = TRUE;
 }
 
@@ -241,20 +597,66 @@ PAGEFRAME_NUMBER tlb_lookup(VPAGE_NUMBER vpage, OPERATION op)
 
 // Finally, set clock_hand to point to the next entry after the
 // entry found above.
-  
-void write_entry_to_mmu(i){
-  mmu_modify_mbit_bitmap(get_pageframe_number(i), get_m_bit(i));
-  mmu_modify_rbit_bitmap(get_pageframe_number(i), get_r_bit(i));
-}
 
 int clock_hand = 0;  // points to next TLB entry to consider evicting
 
 
+/*
+ * Grows [*first, *last] around new_vpage while the page table maps
+ * the neighbors, writable, to the page frames adjacent to new_pframe. The run
+ * never leaves the TLB_COALESCE_PAGES aligned block holding new_vpage,
+ * so the index of a page within an entry always fits the span bits.
+ */
+void find_contiguous_run(VPAGE_NUMBER new_vpage, PAGEFRAME_NUMBER new_pframe,
+                         VPAGE_NUMBER *first, VPAGE_NUMBER *last){
+  VPAGE_NUMBER block_first = new_vpage & ~(TLB_COALESCE_PAGES - 1);
+  VPAGE_NUMBER block_last = block_first + TLB_COALESCE_PAGES - 1;
+
+  *first = new_vpage;
+  while (*first > block_first && new_pframe - (new_vpage - *first) > 0 &&
+         pt_lookup_pageframe(*first - 1) == new_pframe - (new_vpage - *first) - 1 &&
+         !pt_is_read_only(*first - 1)){
+    *first = *first - 1;
+  }
+  *last = new_vpage;
+  while (*last < block_last &&
+         pt_lookup_pageframe(*last + 1) == new_pframe + (*last - new_vpage) + 1 &&
+         !pt_is_read_only(*last + 1)){
+    *last = *last + 1;
+  }
+}
+
+/*
+ * Any entry already caching part of the run is a subset of it (it
+ * was itself a contiguous run inside the same block), so its bits
+ * are handed back to the MMU and the slot is freed for reuse.
+ */
+void absorb_entries_in_run(VPAGE_NUMBER first, VPAGE_NUMBER last){
+  int i;
+  for (i = 0; i < num_tlb_entries; i++){
+    if (get_valid_bit(i) && get_vpage_number(i) >= first && get_vpage_number(i) <= last){
+      write_entry_to_mmu(i);
+      clear_valid_bit(i);
+    }
+  }
+}
+
 void tlb_insert(VPAGE_NUMBER new_vpage,
                 PAGEFRAME_NUMBER new_pframe,
                 BOOL new_mbit,
                 BOOL new_rbit)
 {
+  VPAGE_NUMBER first = new_vpage;
+  VPAGE_NUMBER last = new_vpage;
+  VPAGE_NUMBER v;
+  BOOL read_only = pt_is_read_only(new_vpage);
+
+  // Read-only (shared) pages are never coalesced.
+  if (TLB_COALESCE_PAGES > 1 && !read_only){
+    find_contiguous_run(new_vpage, new_pframe, &first, &last);
+    if (first != last) absorb_entries_in_run(first, last);
+  }
+
   int i = clock_hand;
   do {
     if ((get_valid_bit(i) == 0) || (get_r_bit(i) == 0)){
@@ -262,7 +664,7 @@ void tlb_insert(VPAGE_NUMBER new_vpage,
     }
     else{
       /* Increment and loop */
-      i = (i + 1) % num_tlb_entries;
+      i = (i + 1) & mod_tlb_entries_mask;
     }
   } while (i != clock_hand);
 
@@ -272,13 +674,34 @@ void tlb_insert(VPAGE_NUMBER new_vpage,
       printf("Evicting TLB entry, slot = %d, for pageframe %x. M bit = %d\n",i,new_pframe,new_mbit);
     }
   }
-  set_vpage(i, new_vpage);
-  set_pageframe(i, new_pframe);
+  set_vpage(i, first);
+  set_pageframe(i, new_pframe - (new_vpage - first));
+  set_span(i, last - first + 1);
   set_m_bit(i, new_mbit);
   set_r_bit(i, new_rbit);
+  set_read_only_bit(i, read_only);
   set_valid_bit(i);
 
-  clock_hand = (i + 1) % num_tlb_entries;
+  /* Neighbors take their M and R bits from the MMU bitmaps, which
+     now hold everything the absorbed entries knew about them. */
+  tlb[i].span_mr_bits = 0;
+  if (first != last){
+    for (v = first; v <= last; v++){
+      PAGEFRAME_NUMBER pf = new_pframe - new_vpage + v;
+      BOOL m_bit = (v == new_vpage) ? new_mbit : mmu_get_mbit_bitmap_value(pf);
+      BOOL r_bit = (v == new_vpage) ? new_rbit : mmu_get_rbit_bitmap_value(pf);
+      if (r_bit) {
+        tlb[i].span_mr_bits = tlb[i].span_mr_bits | (1 << (v - first));
+        set_r_bit(i, TRUE);
+      }
+      if (m_bit) {
+        tlb[i].span_mr_bits = tlb[i].span_mr_bits | (1 << (SPAN_MBITS_SHIFT + v - first));
+        set_m_bit(i, TRUE);
+      }
+    }
+  }
+
+  clock_hand = (i + 1) & mod_tlb_entries_mask;
 }
 
 //Writes the M & R bits in the each valid TLB
@@ -289,4 +712,147 @@ void tlb_write_back()
   for (i = 0; i< num_tlb_entries; i++){
     if (get_valid_bit(i)) write_entry_to_mmu(i);
   }
-}
\ No newline at end of file
+}
+
+/*************************************/
+/***** CPUs and TLB shootdowns *******/
+/*************************************/
+
+/*
+ * A CPU's TLB is written back to the MMU bitmaps whenever the CPU
+ * stops running, so the TLBs of the CPUs that are not running never
+ * know anything the bitmaps don't. That lets a shootdown simply
+ * drop the entry, and lets it wait in the CPU's queue until the CPU
+ * runs again: until then the stale entry can't be used.
+ */
+
+typedef struct {
+  VPAGE_NUMBER start[SHOOTDOWN_BATCH];
+  unsigned int count[SHOOTDOWN_BATCH];
+  int length;
+} SHOOTDOWN_QUEUE;
+
+SHOOTDOWN_QUEUE shootdown_queue[NUM_CPUS];
+
+unsigned int shootdowns_posted = 0;
+unsigned int shootdowns_applied = 0;
+unsigned int shootdown_batches = 0;
+unsigned int shootdown_ipis = 0;     // batches the sender had to wait for
+unsigned int shootdown_hits = 0;     // entries the shootdowns dropped
+unsigned int cpu_switches = 0;
+unsigned long long shootdown_stall_ns = 0;
+
+// Makes tlb and tlb_tags (and the clock hand) those of the CPU.
+// With one CPU they always are.
+void load_cpu_tlb(int cpu){
+  if (NUM_CPUS == 1) return;
+  cpu_clock_hand[current_cpu] = clock_hand;
+  current_cpu = cpu;
+  tlb = cpu_tlb[cpu];
+  tlb_tags = cpu_tlb_tags[cpu];
+  clock_hand = cpu_clock_hand[cpu];
+}
+
+// Drops the entries named in the queue of the CPU whose TLB is
+// loaded. Their M and R bits are already in the bitmaps.
+void drain_shootdown_queue(){
+  SHOOTDOWN_QUEUE *queue = &shootdown_queue[current_cpu];
+  int n;
+  if (queue->length == 0) return;
+  for (n = 0; n < queue->length; n++){
+    shootdown_hits += clear_range(queue->start[n], queue->count[n], FALSE);
+  }
+  shootdowns_applied += queue->length;
+  shootdown_batches++;
+  shootdown_stall_ns += (unsigned long long) queue->length * SHOOTDOWN_ENTRY_NS;
+  queue->length = 0;
+}
+
+// Queues a shootdown of the range on every other CPU. A CPU whose
+// queue is full is interrupted, and the sender waits while it drains it.
+void post_shootdowns(VPAGE_NUMBER start, unsigned int count){
+  int running = current_cpu;
+  int cpu;
+  for (cpu = 0; cpu < NUM_CPUS; cpu++){
+    if (cpu == running) continue;
+    if (shootdown_queue[cpu].length == SHOOTDOWN_BATCH){
+      load_cpu_tlb(cpu);
+      drain_shootdown_queue();
+      load_cpu_tlb(running);
+      shootdown_ipis++;
+      shootdown_stall_ns += SHOOTDOWN_IPI_NS;
+    }
+    shootdown_queue[cpu].start[shootdown_queue[cpu].length] = start;
+    shootdown_queue[cpu].count[shootdown_queue[cpu].length] = count;
+    shootdown_queue[cpu].length++;
+    shootdowns_posted++;
+  }
+}
+
+// Stops the running CPU and starts the given one, which first
+// applies the shootdowns sent to it while it was not running.
+void tlb_switch_cpu(int cpu){
+  if (cpu == current_cpu) return;
+  tlb_write_back();
+  load_cpu_tlb(cpu);
+  drain_shootdown_queue();
+  cpu_switches++;
+}
+
+void tlb_print_statistics(){
+  printf("TLB statistics:\n");
+  printf("    Lookups: %u, micro-TLB hits: %u", tlb_lookups, micro_tlb_hits);
+  if (tlb_lookups > 0) printf(" (%.1f%%)", 100.0 * micro_tlb_hits / tlb_lookups);
+  printf("\n");
+  if (NUM_CPUS == 1) return;
+  printf("    CPUs: %d, switches: %u\n", NUM_CPUS, cpu_switches);
+  printf("    Shootdowns sent: %u, applied in %u batches", shootdowns_posted, shootdown_batches);
+  if (shootdown_batches > 0) {
+    printf(" (%.1f per batch)", (double) shootdowns_applied / shootdown_batches);
+  }
+  printf("\n");
+  printf("    Entries dropped by shootdowns: %u\n", shootdown_hits);
+  printf("    Interrupts for full queues: %u\n", shootdown_ipis);
+  printf("    Shootdown stall time: %llu ns\n", shootdown_stall_ns);
+}
+
+// Every CPU's TLB, clock hand and pending shootdowns are saved,
+// then the CPU that was running.
+void tlb_save_state(FILE *file)
+{
+  int running = current_cpu;
+  int cpu;
+  for (cpu = 0; cpu < NUM_CPUS; cpu++){
+    load_cpu_tlb(cpu);
+    fwrite(&clock_hand, sizeof(clock_hand), 1, file);
+    fwrite(tlb_tags, sizeof(unsigned int), num_tlb_entries, file);
+    fwrite(tlb, sizeof(TLB_ENTRY), num_tlb_entries, file);
+    fwrite(&shootdown_queue[cpu], sizeof(SHOOTDOWN_QUEUE), 1, file);
+  }
+  load_cpu_tlb(running);
+  fwrite(&running, sizeof(running), 1, file);
+}
+
+const char *tlb_restore_state(const char *state, const char *end)
+{
+  int running;
+  int cpu;
+  int i;
+
+  for (cpu = 0; cpu < NUM_CPUS; cpu++){
+    load_cpu_tlb(cpu);
+    state = snapshot_read(&clock_hand, state, end, sizeof(clock_hand));
+    if (clock_hand >= num_tlb_entries) snapshot_corrupt();
+    state = snapshot_read(tlb_tags, state, end, num_tlb_entries * sizeof(unsigned int));
+    state = snapshot_read(tlb, state, end, num_tlb_entries * sizeof(TLB_ENTRY));
+    for (i = 0; i < num_tlb_entries; i++){
+      if (get_valid_bit(i) && get_pageframe_number(i) + get_span(i) > num_page_frames) snapshot_corrupt();
+    }
+    state = snapshot_read(&shootdown_queue[cpu], state, end, sizeof(SHOOTDOWN_QUEUE));
+    if (shootdown_queue[cpu].length < 0 || shootdown_queue[cpu].length > SHOOTDOWN_BATCH) snapshot_corrupt();
+  }
+  state = snapshot_read(&running, state, end, sizeof(running));
+  if (running < 0 || running >= NUM_CPUS) snapshot_corrupt();
+  load_cpu_tlb(running);
+  return state;
+}
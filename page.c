@@ -35,10 +35,12 @@ SOFTWARE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "types.h"
 #include "mmu.h"
 #include "page.h"
 #include "cpu.h"
+#include "snapshot.h"
 
 /* Set this to 1 to print out debug statements */
 #define DEBUG 0
@@ -83,6 +85,7 @@ SOFTWARE.
 /* Each entry of a 2nd level page table has
    the following:
      Present/Absent bit: 1 bit
+     Read-only bit: 1 bit (set on pages shared copy-on-write)
      Page Frame: 20 bits
 */
 
@@ -93,9 +96,10 @@ typedef unsigned int PT_ENTRY;
 
 
 // This is declaration of the variable representing
-// the first level page table
+// the first level page table. Its entries are read without
+// locks, so they are volatile.
 
-PT_ENTRY **first_level_page_table;
+PT_ENTRY * volatile *first_level_page_table;
 
 
 // for performing DIV by 1024 to index into the
@@ -111,6 +115,7 @@ PT_ENTRY **first_level_page_table;
 /*************************************/
 
 #define PRESENT_BIT_MASK   0x80000000
+#define READ_ONLY_BIT_MASK 0x40000000
 #define PF_NUMBER_MASK     0x000FFFFF
 #define PRESENT_BIT_SHIFT  31
 
@@ -120,6 +125,165 @@ PT_ENTRY **first_level_page_table;
 #define get_L2_index(vpage) (vpage & MOD_SECOND_PT_MASK)
 #define get_pf_number(entry) (entry & PF_NUMBER_MASK)
 #define get_present_bit(entry) ((entry & PRESENT_BIT_MASK) >> PRESENT_BIT_SHIFT)
+#define get_read_only_bit(entry) ((entry & READ_ONLY_BIT_MASK) != 0)
+
+// Each L2 table has one extra word, after its entries, counting
+// the entries that are present.
+#define present_count(table_L2) (table_L2[TABLE_ENTRIES])
+
+
+/*************************************/
+/****** Epoch-based reclamation ******/
+/*************************************/
+
+/* Walks of the page table take no locks, so an L2 table that is
+   unlinked may still be in use by another thread. Every access to
+   the page table happens inside pt_enter/pt_exit, which records the
+   global epoch the thread saw. A retired table is freed only once
+   the global epoch has moved two past the one it was retired in,
+   which can't happen while any thread is still inside a section
+   begun before it was unlinked.
+
+   All of this, and the atomic updates below, is compiled in only
+   with PT_CONCURRENT set. The simulator itself is single-threaded,
+   so by default the page table is updated with plain loads and
+   stores, pt_enter/pt_exit do nothing, and an L2 table is kept when
+   its last entry is cleared rather than freed and allocated again
+   as pages come and go. */
+
+#ifndef PT_CONCURRENT
+  #define PT_CONCURRENT 0
+#endif
+
+#if PT_CONCURRENT
+
+#ifndef MAX_PT_THREADS
+  #define MAX_PT_THREADS 64
+#endif
+
+typedef struct {
+  volatile int in_use;
+  volatile int active;
+  volatile unsigned int epoch;
+} EPOCH_SLOT;
+
+typedef struct RETIRED_TABLE {
+  PT_ENTRY *table_L2;
+  struct RETIRED_TABLE *next;
+} RETIRED_TABLE;
+
+EPOCH_SLOT epoch_slots[MAX_PT_THREADS];
+volatile unsigned int global_epoch = 0;
+RETIRED_TABLE * volatile retired_tables[3];  // indexed by epoch % 3
+
+__thread int epoch_slot = -1;
+
+void claim_epoch_slot(){
+  int i;
+  for (i = 0; i < MAX_PT_THREADS; i++){
+    if (__sync_bool_compare_and_swap(&epoch_slots[i].in_use, 0, 1)){
+      epoch_slot = i;
+      return;
+    }
+  }
+  printf("Error: more than %d threads are using the page table\n", MAX_PT_THREADS);
+  exit(1);
+}
+
+void pt_enter(){
+  if (epoch_slot < 0) claim_epoch_slot();
+  epoch_slots[epoch_slot].epoch = global_epoch;
+  epoch_slots[epoch_slot].active = 1;
+  __sync_synchronize();
+}
+
+void pt_exit(){
+  __sync_synchronize();
+  epoch_slots[epoch_slot].active = 0;
+}
+
+// Gives the thread's epoch slot back, for another thread to claim.
+void pt_thread_exit(){
+  if (epoch_slot < 0) return;
+  epoch_slots[epoch_slot].active = 0;
+  __sync_lock_release(&epoch_slots[epoch_slot].in_use);
+  epoch_slot = -1;
+}
+
+void free_retired_tables(RETIRED_TABLE *r){
+  RETIRED_TABLE *next;
+  while (r != NULL){
+    next = r->next;
+    free(r->table_L2);
+    free(r);
+    r = next;
+  }
+}
+
+// Moves the global epoch on if every active thread has seen it, and
+// frees the tables retired two epochs before the new one.
+void try_advance_epoch(){
+  unsigned int epoch = global_epoch;
+  int i;
+  for (i = 0; i < MAX_PT_THREADS; i++){
+    if (epoch_slots[i].active && epoch_slots[i].epoch != epoch) return;
+  }
+  if (__sync_bool_compare_and_swap(&global_epoch, epoch, epoch + 1)){
+    free_retired_tables(__sync_lock_test_and_set(&retired_tables[(epoch + 2) % 3], NULL));
+  }
+}
+
+// Hands an unlinked L2 table over to be freed once no thread
+// can still be reading it. Called inside pt_enter/pt_exit, after
+// the table was unlinked. It is filed under the global epoch read
+// now, not the one this thread entered in: the global epoch may
+// have moved on since, and a thread that entered in the newer
+// epoch can still hold the table.
+void retire_L2_page_table(PT_ENTRY *table_L2){
+  RETIRED_TABLE *r = malloc(sizeof(RETIRED_TABLE));
+  unsigned int epoch;
+  __sync_synchronize();
+  epoch = global_epoch;
+  r->table_L2 = table_L2;
+  do {
+    r->next = retired_tables[epoch % 3];
+  } while (!__sync_bool_compare_and_swap(&retired_tables[epoch % 3], r->next, r));
+  try_advance_epoch();
+}
+
+#else
+
+void pt_enter(){}
+void pt_exit(){}
+void pt_thread_exit(){}
+
+// Nothing else can be reading an unlinked table: free it now.
+void retire_L2_page_table(PT_ENTRY *table_L2){
+  free(table_L2);
+}
+
+#endif
+
+#if PT_CONCURRENT
+
+// Stands in the L1 slot of a table while reclaim_L2_page_table
+// decides whether to free it.
+#define RECLAIMING_L2_TABLE ((PT_ENTRY *) 1)
+
+// Returns the L2 table of the L1 slot, waiting out a reclaim in
+// progress. That takes a few instructions: a table is unlinked only
+// once it holds no entries, so it is either freed or put back.
+PT_ENTRY *get_L2_table(int L1_index){
+  PT_ENTRY *table_L2;
+  while ((table_L2 = first_level_page_table[L1_index]) == RECLAIMING_L2_TABLE) ;
+  return table_L2;
+}
+
+#else
+
+#define get_L2_table(L1_index) (first_level_page_table[L1_index])
+
+#endif
 
 
 /*************************************/
@@ -138,6 +302,7 @@ void clear_L2_page_table(PT_ENTRY* table_L2){
   for (i=0; i<TABLE_ENTRIES;i++){
     table_L2[i] = 0; //clear L2 entry i
   }
+  present_count(table_L2) = 0;
 }
 
 /*************************************/
@@ -187,17 +352,23 @@ void pt_initialize_page_table()
   clear_L1_page_table();
 }
 
+// Returns the entry for the two table indices, or 0 if its
+// second-level table does not exist.
+PT_ENTRY find_entry(int L1_index, int L2_index){
+  PT_ENTRY* table_L2 = get_L2_table(L1_index);
+  if(table_L2 == NULL){
+    return 0;
+  }
+  return ((volatile PT_ENTRY *) table_L2)[L2_index];
+}
+
 /* 
  * Given two table indices, determine whther the pageframe
  * number is stored and return it. Otherwise return -1.
  */
 
 PAGEFRAME_NUMBER find_pf_number(int L1_index, int L2_index){
-  PT_ENTRY* table_L2 = first_level_page_table[L1_index];
-  if(table_L2 == NULL){
-    return -1;
-  }
-  PT_ENTRY entry = table_L2[L2_index];
+  PT_ENTRY entry = find_entry(L1_index, L2_index);
   if (get_present_bit(entry) == 0){
     return -1;
   }
@@ -206,73 +377,289 @@ PAGEFRAME_NUMBER find_pf_number(int L1_index, int L2_index){
   }
 }
 
+// Returns the page frame holding the specified virtual page, or
+// -1 if it is not present. Unlike pt_get_pageframe, this leaves
+// page_fault alone, so the TLB can use it to probe neighboring pages.
+PAGEFRAME_NUMBER pt_lookup_pageframe(VPAGE_NUMBER vpage)
+{
+  PAGEFRAME_NUMBER pf_number;
+  pt_enter();
+  pf_number = find_pf_number(get_L1_index(vpage), get_L2_index(vpage));
+  pt_exit();
+  return pf_number;
+}
+
+// TRUE if the specified virtual page is present and read-only.
+BOOL pt_is_read_only(VPAGE_NUMBER vpage)
+{
+  PT_ENTRY entry;
+  pt_enter();
+  entry = find_entry(get_L1_index(vpage), get_L2_index(vpage));
+  pt_exit();
+  return get_present_bit(entry) && get_read_only_bit(entry);
+}
+
 BOOL page_fault;  //set to true if there is a page fault
 
 //This is called when there is a TLB_miss.
 // Using the page table, this looks up the page frame 
 // corresponding to the specified virtual page.
 // If the desired page is not present, the variable page_fault
-// should be set to TRUE (otherwise FALSE).
+// should be set to TRUE (otherwise FALSE). A read-only page is
+// returned like any other: the TLB raises the fault for a STORE
+// to it.
 PAGEFRAME_NUMBER pt_get_pageframe(VPAGE_NUMBER vpage)
 {
 
   int L1_index = get_L1_index(vpage);
   int L2_index = get_L2_index(vpage);
 
-  PAGEFRAME_NUMBER pf_number = find_pf_number(L1_index,L2_index);
+  pt_enter();
+  PT_ENTRY entry = find_entry(L1_index,L2_index);
+  pt_exit();
 
-  if (pf_number == -1) { //could not be found
+  if (get_present_bit(entry) == 0) { //could not be found
     page_fault = TRUE;
   }
   else{
     page_fault = FALSE;
-    return pf_number;
+    return get_pf_number(entry);
   }
 }
 
 /*
  * Create a level 2 page table, clear 
  * it, and set its level 1 table entry. 
+ * If another thread set the entry first, its table is
+ * the one returned and ours is thrown away.
  */
 PT_ENTRY* create_L2_page_table(int L1_index){
-  PT_ENTRY* table_L2 = malloc(TABLE_ENTRIES*ENTRY_SIZE);
+  PT_ENTRY* table_L2 = malloc((TABLE_ENTRIES + 1) * sizeof(PT_ENTRY));
   clear_L2_page_table(table_L2);
+#if PT_CONCURRENT
+  if (!__sync_bool_compare_and_swap(&first_level_page_table[L1_index], NULL, table_L2)){
+    free(table_L2);
+    table_L2 = get_L2_table(L1_index);
+  }
+#else
   first_level_page_table[L1_index] = table_L2;
+#endif
   return table_L2;
 }
 
-// This inserts into the page table an entry mapping of the 
-// the specified virtual page to the specified page frame.
-// It might require the creation of a second-level page table
-// to hold the entry, if it doesn't already exist.
-void pt_update_pagetable(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe)
-{
+#if PT_CONCURRENT
+
+/*
+ * Unlinks an L2 table whose last entry was just cleared. A thread
+ * may be adding an entry to it at the same time. It writes the
+ * entry, counts it, fences and checks that the table is still
+ * linked; we put RECLAIMING_L2_TABLE in the L1 slot, fence and check
+ * the count. One of us sees the other's write: either that thread
+ * sees the table gone and adds its entry again to the current table,
+ * or we see the count is not 0 and link the table back. Entries are
+ * never moved between tables, so no update or clear can be lost in
+ * a move.
+ */
+void reclaim_L2_page_table(int L1_index, PT_ENTRY* table_L2){
+  if (!__sync_bool_compare_and_swap(&first_level_page_table[L1_index], table_L2, RECLAIMING_L2_TABLE)) return;
+  __sync_synchronize();
+  if (present_count(table_L2) != 0){
+    __sync_bool_compare_and_swap(&first_level_page_table[L1_index], RECLAIMING_L2_TABLE, table_L2);
+    return;
+  }
+  __sync_bool_compare_and_swap(&first_level_page_table[L1_index], RECLAIMING_L2_TABLE, NULL);
+  retire_L2_page_table(table_L2);
+}
+
+// Sets the entry for vpage, creating its L2 table if needed.
+// Called inside pt_enter/pt_exit.
+void update_entry(VPAGE_NUMBER vpage, PT_ENTRY value){
   int L1_index = get_L1_index(vpage);
   int L2_index = get_L2_index(vpage);
+  PT_ENTRY* table_L2;
+  PT_ENTRY old;
+
+  for (;;) {
+    table_L2 = get_L2_table(L1_index);
+    if(table_L2 == NULL) {
+      create_L2_page_table(L1_index);
+      continue;
+    }
+    old = __sync_lock_test_and_set(&table_L2[L2_index], value);
+    if (!get_present_bit(old)) __sync_fetch_and_add(&present_count(table_L2), 1);
+    __sync_synchronize();
+    if (first_level_page_table[L1_index] == table_L2) return;
+  }
+}
+
+// Clears one entry, unlinking the table if it was the last one
+// present. If the table was unlinked meanwhile, a thread adding
+// the entry may have added it again to the current table, so the
+// clear is repeated there. Called inside pt_enter/pt_exit.
+void clear_entry(int L1_index, int L2_index, PT_ENTRY* table_L2){
+  while (table_L2 != NULL){
+    if (get_present_bit(__sync_lock_test_and_set(&table_L2[L2_index], 0)) &&
+        __sync_sub_and_fetch(&present_count(table_L2), 1) == 0){
+      reclaim_L2_page_table(L1_index, table_L2);
+      return;
+    }
+    __sync_synchronize();
+    if (first_level_page_table[L1_index] == table_L2) return;
+    table_L2 = get_L2_table(L1_index);
+  }
+}
 
+#else
+
+// Sets the entry for vpage, creating its L2 table if needed.
+void update_entry(VPAGE_NUMBER vpage, PT_ENTRY value){
+  int L1_index = get_L1_index(vpage);
+  int L2_index = get_L2_index(vpage);
   PT_ENTRY* table_L2 = first_level_page_table[L1_index];
+
   if(table_L2 == NULL) {
     table_L2 = create_L2_page_table(L1_index);
   }
+  if (!get_present_bit(table_L2[L2_index])) present_count(table_L2)++;
+  table_L2[L2_index] = value;
+}
+
+// Clears one entry. The table stays, even once it is empty.
+void clear_entry(int L1_index, int L2_index, PT_ENTRY* table_L2){
+  if (get_present_bit(table_L2[L2_index])){
+    table_L2[L2_index] = 0;
+    present_count(table_L2)--;
+  }
+}
+
+#endif
 
+// This inserts into the page table an entry mapping of the 
+// the specified virtual page to the specified page frame.
+// It might require the creation of a second-level page table
+// to hold the entry, if it doesn't already exist.
+void pt_update_pagetable(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe)
+{
   unsigned int value = pframe | PRESENT_BIT_MASK;
-  table_L2[L2_index] = value;
+  pt_enter();
+  update_entry(vpage, value);
+  pt_exit();
+}
+
+// Like pt_update_pagetable, but the page is mapped read-only, so
+// a STORE to it causes a page fault.
+void pt_update_pagetable_read_only(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe)
+{
+  unsigned int value = pframe | PRESENT_BIT_MASK | READ_ONLY_BIT_MASK;
+  pt_enter();
+  update_entry(vpage, value);
+  pt_exit();
 }
 
 
 // This clears a page table entry by clearing its present bit.
 // It is called by the OS (in kernel.c) when a page is evicted
-// from a page frame.
+// from a page frame. With PT_CONCURRENT, an L2 table left with no
+// entries is freed.
 void pt_clear_page_table_entry(VPAGE_NUMBER vpage)
 {
   int L1_index = get_L1_index(vpage);
   int L2_index = get_L2_index(vpage);
 
-  PT_ENTRY* table_L2 = first_level_page_table[L1_index];
+  pt_enter();
+  PT_ENTRY* table_L2 = get_L2_table(L1_index);
   if(table_L2 == NULL) {
     /* Control should never reach here */
     SAY("Tried to remove a vpage that does not exist!\n");
+    pt_exit();
     return;
   }
-  table_L2[L2_index] = 0; //clear the entry
+  clear_entry(L1_index, L2_index, table_L2);
+  pt_exit();
+}
+
+// Clears the entries of count virtual pages starting at start.
+// A second-level table the range covers completely is unlinked
+// and freed as a whole instead of being cleared entry by entry.
+void pt_clear_range(VPAGE_NUMBER start, unsigned int count)
+{
+  VPAGE_NUMBER end;
+  VPAGE_NUMBER table_start, first, last;
+  int L1_index;
+  PT_ENTRY* table_L2;
+
+  if (count == 0 || start >= TABLE_ENTRIES * TABLE_ENTRIES) return;
+  if (count > TABLE_ENTRIES * TABLE_ENTRIES - start) count = TABLE_ENTRIES * TABLE_ENTRIES - start;
+  end = start + count - 1;   // last page of the range
+  pt_enter();
+  for (L1_index = get_L1_index(start); L1_index <= get_L1_index(end); L1_index++){
+    table_L2 = get_L2_table(L1_index);
+    if (table_L2 == NULL) continue;
+
+    table_start = L1_index << DIV_FIRST_PT_SHIFT;
+    first = (start > table_start) ? start : table_start;
+    last = (end < table_start + MOD_SECOND_PT_MASK) ? end : table_start + MOD_SECOND_PT_MASK;
+
+    if (first == table_start && last == table_start + MOD_SECOND_PT_MASK){
+#if PT_CONCURRENT
+      if (__sync_bool_compare_and_swap(&first_level_page_table[L1_index], table_L2, NULL))
+        retire_L2_page_table(table_L2);
+#else
+      first_level_page_table[L1_index] = NULL;
+      retire_L2_page_table(table_L2);
+#endif
+      continue;
+    }
+    for (; first <= last; first++){
+      // Stop once the table is gone: its last entry was cleared.
+      if (first_level_page_table[L1_index] != table_L2) break;
+      clear_entry(L1_index, get_L2_index(first), table_L2);
+    }
+  }
+  pt_exit();
+}
+
+
+/*************************************/
+/********* Snapshot support **********/
+/*************************************/
+
+void pt_save_state(FILE *file)
+{
+  unsigned int count = 0;
+  unsigned int i;
+  for (i = 0; i < TABLE_ENTRIES; i++){
+    if (first_level_page_table[i] != NULL) count++;
+  }
+  fwrite(&count, sizeof(count), 1, file);
+  for (i = 0; i < TABLE_ENTRIES; i++){
+    if (first_level_page_table[i] != NULL){
+      fwrite(&i, sizeof(i), 1, file);
+      fwrite(first_level_page_table[i], sizeof(PT_ENTRY), TABLE_ENTRIES, file);
+    }
+  }
+}
+
+const char *pt_restore_state(const char *state, const char *end)
+{
+  unsigned int count;
+  unsigned int L1_index;
+  unsigned int i;
+  PT_ENTRY* table_L2;
+
+  state = snapshot_read(&count, state, end, sizeof(count));
+  while (count-- > 0){
+    state = snapshot_read(&L1_index, state, end, sizeof(L1_index));
+    if (L1_index >= TABLE_ENTRIES) snapshot_corrupt();
+    table_L2 = first_level_page_table[L1_index];
+    if (table_L2 == NULL) table_L2 = create_L2_page_table(L1_index);
+    state = snapshot_read(table_L2, state, end, TABLE_ENTRIES * sizeof(PT_ENTRY));
+    present_count(table_L2) = 0;
+    for (i = 0; i < TABLE_ENTRIES; i++){
+      if (!get_present_bit(table_L2[i])) continue;
+      if (get_pf_number(table_L2[i]) >= num_page_frames) snapshot_corrupt();
+      present_count(table_L2)++;
+    }
+  }
+  return state;
 }
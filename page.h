@@ -1,16 +1,46 @@
 
 extern BOOL page_fault;
 
+// Built with PT_CONCURRENT, the page table may be used by several
+// threads at once. Lookups take no locks; second-level tables are
+// installed with a compare-and-swap, and one left empty is freed
+// once no thread can still be reading it. A thread that is done
+// with the page table calls pt_thread_exit, so that the slot it
+// holds among the MAX_PT_THREADS is free for another thread.
+
 void pt_initialize_page_table();
 
+// Called by a thread that will not use the page table again.
+void pt_thread_exit();
+
 // Using the page table, this looks up the page frame 
 // corresponding to the specified virtual page.
 PAGEFRAME_NUMBER pt_get_pageframe(VPAGE_NUMBER vpage);
 
+// Like pt_get_pageframe, but without setting page_fault. Returns
+// -1 if the virtual page is not present.
+PAGEFRAME_NUMBER pt_lookup_pageframe(VPAGE_NUMBER vpage);
+
+// TRUE if the virtual page is present and mapped read-only.
+BOOL pt_is_read_only(VPAGE_NUMBER vpage);
+
 // This inserts into the page table the mapping of the 
 // the specified virtual page to the specified page frame.
 void pt_update_pagetable(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe);
 
+// The same, but mapping the page read-only, for sharing it
+// copy-on-write.
+void pt_update_pagetable_read_only(VPAGE_NUMBER vpage, PAGEFRAME_NUMBER pframe);
+
 // This clears the entry of a page table by clearing the present bit.
 // It is called when a page is evicted from memory
 void pt_clear_page_table_entry(VPAGE_NUMBER vpage);
+
+// Clears the entries of count virtual pages starting at start,
+// freeing any second-level table the range covers completely.
+void pt_clear_range(VPAGE_NUMBER start, unsigned int count);
+
+// Snapshot support: the second-level page tables that exist,
+// each preceded by its index in the first-level page table.
+void pt_save_state(FILE *file);
+const char *pt_restore_state(const char *state, const char *end);
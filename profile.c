@@ -0,0 +1,173 @@
+/***********************************/
+/******* Hot page profiling ********/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "profile.h"
+
+/* A counter per virtual page would not fit in a fixed amount of
+   memory, so the events are counted in a count-min sketch:
+   SKETCH_DEPTH rows of SKETCH_WIDTH counters, each row indexed by
+   its own hash of the vpage. A page's count is the smallest of its
+   counters, which is never too low and, with high probability, too
+   high by at most e * events / SKETCH_WIDTH. Alongside, the
+   PROFILE_TOP_K pages with the highest counts seen so far are kept
+   for the report. */
+
+#ifndef SKETCH_WIDTH
+  #define SKETCH_WIDTH 4096     // must be a power of 2
+#endif
+#ifndef SKETCH_DEPTH
+  #define SKETCH_DEPTH 4
+#endif
+#ifndef PROFILE_TOP_K
+  #define PROFILE_TOP_K 16
+#endif
+
+typedef struct {
+  const char *event;
+  unsigned int counts[SKETCH_DEPTH][SKETCH_WIDTH];
+  VPAGE_NUMBER top_vpage[PROFILE_TOP_K];
+  unsigned int top_count[PROFILE_TOP_K];
+  int top_size;
+  unsigned long long events;
+} HOT_PAGE_SKETCH;
+
+HOT_PAGE_SKETCH tlb_miss_profile = { "TLB misses" };
+HOT_PAGE_SKETCH page_fault_profile = { "page faults" };
+
+// Odd multipliers for the row hashes.
+unsigned int sketch_multiplier[] = {
+  0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F,
+  0x165667B1, 0xD3A2646D, 0xFD7046C5, 0xB55A4F09
+};
+
+// 32 - log2(SKETCH_WIDTH): the top bits of the product pick the counter.
+#define sketch_shift (32 - __builtin_ctz(SKETCH_WIDTH))
+
+#define sketch_hash(row, vpage) \
+  ((((vpage) + 1) * sketch_multiplier[row]) >> sketch_shift)
+
+
+/*************************************/
+/************** Counting *************/
+/*************************************/
+
+/* Conservative update: only the counters at the page's current
+   minimum are incremented, which keeps the other pages' estimates
+   tighter. Returns the page's new estimate. */
+unsigned int sketch_add(HOT_PAGE_SKETCH *sketch, VPAGE_NUMBER vpage)
+{
+  unsigned int *counter[SKETCH_DEPTH];
+  unsigned int estimate = ~0U;
+  int row;
+
+  for (row = 0; row < SKETCH_DEPTH; row++) {
+    counter[row] = &sketch->counts[row][sketch_hash(row, vpage)];
+    if (*counter[row] < estimate) estimate = *counter[row];
+  }
+  estimate++;
+  for (row = 0; row < SKETCH_DEPTH; row++) {
+    if (*counter[row] < estimate) *counter[row] = estimate;
+  }
+  return estimate;
+}
+
+unsigned int sketch_estimate(HOT_PAGE_SKETCH *sketch, VPAGE_NUMBER vpage)
+{
+  unsigned int estimate = ~0U;
+  int row;
+
+  for (row = 0; row < SKETCH_DEPTH; row++) {
+    if (sketch->counts[row][sketch_hash(row, vpage)] < estimate)
+      estimate = sketch->counts[row][sketch_hash(row, vpage)];
+  }
+  return estimate;
+}
+
+void profile_event(HOT_PAGE_SKETCH *sketch, VPAGE_NUMBER vpage)
+{
+  unsigned int estimate = sketch_add(sketch, vpage);
+  int i, smallest = 0;
+
+  sketch->events++;
+  for (i = 0; i < sketch->top_size; i++) {
+    if (sketch->top_vpage[i] == vpage) {
+      sketch->top_count[i] = estimate;
+      return;
+    }
+    if (sketch->top_count[i] < sketch->top_count[smallest]) smallest = i;
+  }
+  if (sketch->top_size < PROFILE_TOP_K) smallest = sketch->top_size++;
+  else if (estimate <= sketch->top_count[smallest]) return;
+  sketch->top_vpage[smallest] = vpage;
+  sketch->top_count[smallest] = estimate;
+}
+
+void profile_tlb_miss(VPAGE_NUMBER vpage)
+{
+  profile_event(&tlb_miss_profile, vpage);
+}
+
+void profile_page_fault(VPAGE_NUMBER vpage)
+{
+  profile_event(&page_fault_profile, vpage);
+}
+
+unsigned int profile_tlb_misses(VPAGE_NUMBER vpage)
+{
+  return sketch_estimate(&tlb_miss_profile, vpage);
+}
+
+unsigned int profile_page_faults(VPAGE_NUMBER vpage)
+{
+  return sketch_estimate(&page_fault_profile, vpage);
+}
+
+
+/*************************************/
+/************** Report ***************/
+/*************************************/
+
+void print_hot_pages(HOT_PAGE_SKETCH *sketch)
+{
+  int i, j, hottest;
+  VPAGE_NUMBER vpage;
+  unsigned int count;
+
+  printf("Hottest pages by %s (%llu in all, counts may be over by up to %llu):\n",
+         sketch->event, sketch->events, (sketch->events * 2719 / 1000 + SKETCH_WIDTH - 1) / SKETCH_WIDTH);
+  for (i = 0; i < sketch->top_size; i++) {
+    hottest = i;
+    for (j = i + 1; j < sketch->top_size; j++) {
+      if (sketch->top_count[j] > sketch->top_count[hottest]) hottest = j;
+    }
+    vpage = sketch->top_vpage[hottest];
+    count = sketch->top_count[hottest];
+    sketch->top_vpage[hottest] = sketch->top_vpage[i];
+    sketch->top_count[hottest] = sketch->top_count[i];
+    sketch->top_vpage[i] = vpage;
+    sketch->top_count[i] = count;
+    printf("    page %x: %u\n", vpage, count);
+  }
+}
+
+void print_profile()
+{
+  print_hot_pages(&tlb_miss_profile);
+  print_hot_pages(&page_fault_profile);
+}
+
+void profile_initialize()
+{
+  if (SKETCH_DEPTH > sizeof(sketch_multiplier) / sizeof(unsigned int) ||
+      (SKETCH_WIDTH & (SKETCH_WIDTH - 1)) != 0 || SKETCH_WIDTH < 2) {
+    printf("Error: SKETCH_DEPTH must be at most 8 and SKETCH_WIDTH a power of 2\n");
+    exit(1);
+  }
+  atexit(print_profile);
+}
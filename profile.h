@@ -0,0 +1,18 @@
+
+// Set to 1 to profile which virtual pages cause the most TLB
+// misses and page faults, and print the hottest ones at exit.
+#ifndef HOT_PAGE_PROFILE
+#define HOT_PAGE_PROFILE 0
+#endif
+
+// Registers the report to be printed at exit.
+void profile_initialize();
+
+// Counts a TLB miss, or a page fault, on the virtual page.
+void profile_tlb_miss(VPAGE_NUMBER vpage);
+void profile_page_fault(VPAGE_NUMBER vpage);
+
+// The estimated number of TLB misses, or page faults, on the
+// virtual page: never fewer than were counted.
+unsigned int profile_tlb_misses(VPAGE_NUMBER vpage);
+unsigned int profile_page_faults(VPAGE_NUMBER vpage);
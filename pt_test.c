@@ -0,0 +1,152 @@
+/***********************************/
+/**** Concurrent page table check **/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+/* Runs the page table, built with PT_CONCURRENT, from several
+   threads at once. Each writer owns a few pages in each of a few
+   4 MB regions, so the second-level tables fill up and empty again
+   all the time, and checks every update and clear of its pages as
+   it goes. The writers also all update and clear one shared page
+   in each region; a writer must never find its own older mapping
+   of it come back. Reader threads look pages up all over the same
+   regions, which AddressSanitizer turns into a check that no table is freed
+   while a thread can still read it. Exits with 1 on a failure. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "types.h"
+#include "page.h"
+
+#define WRITERS 6
+#define READERS 2
+#define REGIONS 4
+#define PAGES_PER_WRITER 2     // in each region
+#define ROUNDS 200000
+#define SHORT_LIVED_THREADS 200
+
+BOOL verbose = FALSE;
+
+unsigned int num_pages = 0x100000;
+unsigned int num_pages_mod_mask = 0xFFFFF;
+unsigned int num_page_frames = 0x100000;
+
+int page_fault_count;
+
+// The rest of the simulator is linked in, but never runs.
+void issue_page_fault_trap(VPAGE_NUMBER vpage)
+{
+}
+
+volatile unsigned int failures = 0;
+volatile int writers_done = 0;
+
+// The page every writer updates in a region, after their own.
+#define shared_page(region) (((region) << 10) | (PAGES_PER_WRITER * WRITERS))
+
+// The pages of a writer are spread over the regions, interleaved
+// with those of the other writers.
+VPAGE_NUMBER writer_page(int writer, unsigned int n)
+{
+  unsigned int region = n / PAGES_PER_WRITER;
+  unsigned int slot = n % PAGES_PER_WRITER;
+  return (region << 10) | (slot * WRITERS + writer);
+}
+
+void fail(const char *what, VPAGE_NUMBER vpage)
+{
+  if (__sync_fetch_and_add(&failures, 1) < 10) printf("FAILED: %s, page %x\n", what, vpage);
+}
+
+void *writer(void *arg)
+{
+  int w = (int) (long) arg;
+  unsigned int seed = w * 7919 + 1;
+  PAGEFRAME_NUMBER last[REGIONS * PAGES_PER_WRITER];
+  PAGEFRAME_NUMBER pframe;
+  VPAGE_NUMBER vpage;
+  unsigned int round;
+  unsigned int n;
+  unsigned int seq = 0;
+
+  for (n = 0; n < REGIONS * PAGES_PER_WRITER; n++) last[n] = -1;
+  for (round = 0; round < ROUNDS; round++) {
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 28) == 0) {
+      // A frame number tagged with the writer and a sequence number.
+      vpage = shared_page((seed >> 8) % REGIONS);
+      if ((seed >> 20) & 1) {
+        seq = (seq + 1) & 0xFFFF;
+        pt_update_pagetable(vpage, (w << 16) | seq);
+      }
+      else if (pt_lookup_pageframe(vpage) != -1) pt_clear_page_table_entry(vpage);
+      pframe = pt_lookup_pageframe(vpage);
+      if (pframe != -1 && (pframe >> 16) == w && (pframe & 0xFFFF) != seq) fail("old mapping came back", vpage);
+      continue;
+    }
+    n = (seed >> 8) % (REGIONS * PAGES_PER_WRITER);
+    vpage = writer_page(w, n);
+    if (pt_lookup_pageframe(vpage) != last[n]) fail("page changed by another thread", vpage);
+    if (((seed >> 20) & 1) || last[n] == -1) {
+      pframe = (seed >> 4) & 0xFFFFF;
+      pt_update_pagetable(vpage, pframe);
+      if (pt_lookup_pageframe(vpage) != pframe) fail("update lost", vpage);
+      last[n] = pframe;
+    }
+    else {
+      pt_clear_page_table_entry(vpage);
+      if (pt_lookup_pageframe(vpage) != -1) fail("clear lost", vpage);
+      last[n] = -1;
+    }
+  }
+  pt_thread_exit();
+  return NULL;
+}
+
+void *reader(void *arg)
+{
+  unsigned int seed = (unsigned int) (long) arg;
+  while (!writers_done) {
+    seed = seed * 1103515245 + 12345;
+    pt_lookup_pageframe((((seed >> 8) % REGIONS) << 10) | ((seed >> 16) % (PAGES_PER_WRITER * WRITERS + 1)));
+  }
+  pt_thread_exit();
+  return NULL;
+}
+
+void *short_lived(void *arg)
+{
+  pt_lookup_pageframe((VPAGE_NUMBER) (long) arg);
+  pt_thread_exit();
+  return NULL;
+}
+
+int main()
+{
+  pthread_t writers[WRITERS];
+  pthread_t readers[READERS];
+  pthread_t thread;
+  long i;
+
+  pt_initialize_page_table();
+  for (i = 0; i < READERS; i++) pthread_create(&readers[i], NULL, reader, (void *) (i + 1));
+  for (i = 0; i < WRITERS; i++) pthread_create(&writers[i], NULL, writer, (void *) i);
+  for (i = 0; i < WRITERS; i++) pthread_join(writers[i], NULL);
+  writers_done = 1;
+  for (i = 0; i < READERS; i++) pthread_join(readers[i], NULL);
+
+  // More threads than MAX_PT_THREADS, one after the other: each
+  // gives its epoch slot back as it exits.
+  for (i = 0; i < SHORT_LIVED_THREADS; i++) {
+    pthread_create(&thread, NULL, short_lived, (void *) i);
+    pthread_join(thread, NULL);
+  }
+
+  if (failures > 0) {
+    printf("pt_test: %u failures\n", failures);
+    return 1;
+  }
+  printf("pt_test passed\n");
+  return 0;
+}
@@ -0,0 +1,145 @@
+/***********************************/
+/***** Simulator state snapshots ***/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "types.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "page.h"
+#include "tlb.h"
+#include "kernel.h"
+#include "snapshot.h"
+
+/* File layout: the header, then the three bitmaps, then the state
+   written by tlb_save_state, pt_save_state and kernel_save_state,
+   in that order. Only second-level page tables that exist are
+   stored, which keeps the file small. */
+
+#define SNAPSHOT_MAGIC "TLBSNAP3"
+
+typedef struct {
+  char magic[8];
+  unsigned int num_page_frames;
+  unsigned int num_tlb_entries;
+  unsigned int bitmap_size;
+  unsigned int num_cpus;
+} SNAPSHOT_HEADER;
+
+BOOL snapshot_restore_pending = FALSE;
+
+char *snapshot_save_path;
+char *snapshot_load_path;
+
+void snapshot_initialize()
+{
+  snapshot_load_path = getenv("SNAPSHOT_LOAD");
+  snapshot_save_path = getenv("SNAPSHOT_SAVE");
+  snapshot_restore_pending = (snapshot_load_path != NULL);
+  if (snapshot_save_path != NULL) atexit(snapshot_save);
+}
+
+void snapshot_save()
+{
+  SNAPSHOT_HEADER header;
+  FILE *file = fopen(snapshot_save_path, "wb");
+
+  if (file == NULL) {
+    printf("Error: cannot write snapshot %s\n", snapshot_save_path);
+    return;
+  }
+
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.num_page_frames = num_page_frames;
+  header.num_tlb_entries = num_tlb_entries;
+  header.bitmap_size = bitmap_size;
+  header.num_cpus = NUM_CPUS;
+  fwrite(&header, sizeof(header), 1, file);
+
+  fwrite(rbit_bitmap, sizeof(unsigned int), bitmap_size, file);
+  fwrite(mbit_bitmap, sizeof(unsigned int), bitmap_size, file);
+  fwrite(pageframe_bitmap, sizeof(unsigned int), bitmap_size, file);
+  tlb_save_state(file);
+  pt_save_state(file);
+  kernel_save_state(file);
+
+  fclose(file);
+}
+
+/* Gives up on loading a snapshot. The atexit handlers are skipped:
+   they would print statistics for a run that never started, and
+   save its state over SNAPSHOT_SAVE, which may be the same file. */
+void abort_restore()
+{
+  fflush(stdout);
+  _exit(1);
+}
+
+void snapshot_corrupt()
+{
+  printf("Error: snapshot %s is corrupt\n", snapshot_load_path);
+  abort_restore();
+}
+
+const char *snapshot_read(void *dest, const char *state, const char *end, size_t size)
+{
+  if (end - state < size) snapshot_corrupt();
+  memcpy(dest, state, size);
+  return state + size;
+}
+
+void snapshot_restore()
+{
+  SNAPSHOT_HEADER header;
+  struct stat file_stat;
+  const char *image;
+  const char *end;
+  const char *state;
+  int fd;
+
+  snapshot_restore_pending = FALSE;
+
+  fd = open(snapshot_load_path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &file_stat) < 0 || file_stat.st_size < sizeof(header)) {
+    printf("Error: cannot read snapshot %s\n", snapshot_load_path);
+    abort_restore();
+  }
+  image = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    printf("Error: cannot map snapshot %s\n", snapshot_load_path);
+    abort_restore();
+  }
+
+  end = image + file_stat.st_size;
+  memcpy(&header, image, sizeof(header));
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.num_page_frames != num_page_frames ||
+      header.num_tlb_entries != num_tlb_entries ||
+      header.bitmap_size != bitmap_size ||
+      header.num_cpus != NUM_CPUS) {
+    printf("Error: snapshot %s does not match %d page frames, %d TLB entries and %d CPUs\n",
+           snapshot_load_path, num_page_frames, num_tlb_entries, NUM_CPUS);
+    abort_restore();
+  }
+
+  state = image + sizeof(header);
+  state = snapshot_read(rbit_bitmap, state, end, bitmap_size * sizeof(unsigned int));
+  state = snapshot_read(mbit_bitmap, state, end, bitmap_size * sizeof(unsigned int));
+  state = snapshot_read(pageframe_bitmap, state, end, bitmap_size * sizeof(unsigned int));
+  state = tlb_restore_state(state, end);
+  state = pt_restore_state(state, end);
+  state = kernel_restore_state(state, end);
+
+  if (state != end) snapshot_corrupt();
+  munmap((void *) image, file_stat.st_size);
+
+  if (verbose) printf("Restored snapshot %s\n", snapshot_load_path);
+}
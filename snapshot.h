@@ -0,0 +1,29 @@
+
+/* Checkpoints of the simulated machine: the page table, the TLB,
+   the M, R and pageframe bitmaps, and the kernel's clock hand and
+   replacement state. Setting SNAPSHOT_SAVE=file in the environment
+   writes a snapshot when the simulation exits; SNAPSHOT_LOAD=file
+   maps one back in and starts from it instead of from an empty
+   machine. The number of page frames, TLB entries and CPUs must
+   match those the snapshot was taken with. */
+
+// Reads the environment. Called by the kernel at startup.
+void snapshot_initialize();
+
+// TRUE until a requested snapshot has been loaded.
+extern BOOL snapshot_restore_pending;
+
+// Loads the snapshot named by SNAPSHOT_LOAD.
+void snapshot_restore();
+
+// Writes the snapshot named by SNAPSHOT_SAVE.
+void snapshot_save();
+
+// Used by the restore functions: copies size bytes from state
+// to dest and returns a pointer just past them. A snapshot that
+// ends before end is reached is reported as corrupt.
+const char *snapshot_read(void *dest, const char *state, const char *end, size_t size);
+
+// Reports the snapshot being loaded as corrupt and exits, without
+// saving a snapshot or printing statistics.
+void snapshot_corrupt();
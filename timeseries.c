@@ -0,0 +1,171 @@
+/***********************************/
+/****** Counter time series ********/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "kernel.h"
+#include "timeseries.h"
+
+/* The binary file is a header followed by the samples as they are
+   laid out in memory. Counters are cumulative; rates are left to
+   the reader. */
+
+#define TIMESERIES_MAGIC "TLBTIME1"
+
+typedef struct {
+  unsigned int instructions;
+  unsigned int tlb_misses;
+  unsigned int page_faults;
+  unsigned int evictions;
+  unsigned int writebacks;
+} SAMPLE;
+
+typedef struct {
+  char magic[8];
+  unsigned int num_samples;
+  unsigned int sample_size;
+} TIMESERIES_HEADER;
+
+unsigned int timeseries_next_sample = ~0U;
+BOOL timeseries_at_clock = FALSE;
+
+char *timeseries_path;
+SAMPLE *samples;
+unsigned int num_samples;
+
+// Instructions between samples, or clock interrupts between
+// samples when sampling at clock interrupts.
+unsigned int sample_interval;
+unsigned int clock_interrupts_left;
+
+void timeseries_save();
+
+void timeseries_initialize()
+{
+  char *every;
+
+  timeseries_path = getenv("TIMESERIES_SAVE");
+  if (timeseries_path == NULL) return;
+
+  every = getenv("TIMESERIES_EVERY");
+  sample_interval = every ? atoi(every) : 0;
+  if (sample_interval == 0) {
+    timeseries_at_clock = TRUE;
+    sample_interval = 1;
+    clock_interrupts_left = 1;
+  }
+  else timeseries_next_sample = sample_interval;
+
+  samples = malloc(TIMESERIES_SAMPLES * sizeof(SAMPLE));
+  if (samples == NULL || TIMESERIES_SAMPLES < 2) {
+    printf("Error: cannot allocate %d time series samples\n", TIMESERIES_SAMPLES);
+    exit(1);
+  }
+  num_samples = 0;
+  atexit(timeseries_save);
+}
+
+// Keeps every other sample, ending with the latest, and samples
+// half as often from now on.
+void halve_samples()
+{
+  unsigned int i;
+  unsigned int kept = 0;
+
+  for (i = (num_samples - 1) & 1; i < num_samples; i += 2) samples[kept++] = samples[i];
+  num_samples = kept;
+  sample_interval = sample_interval * 2;
+}
+
+void record_sample(unsigned int instructions)
+{
+  SAMPLE *sample = &samples[num_samples++];
+
+  sample->instructions = instructions;
+  sample->tlb_misses = tlb_miss_count;
+  sample->page_faults = page_fault_count;
+  sample->evictions = evicted_page_count;
+  sample->writebacks = evicted_page_written_to_disk_count;
+}
+
+void timeseries_sample(unsigned int instructions)
+{
+  if (timeseries_at_clock) {
+    if (--clock_interrupts_left != 0) return;
+    clock_interrupts_left = sample_interval;
+  }
+
+  if (num_samples == TIMESERIES_SAMPLES) {
+    // The latest sample is kept, so this one falls halfway
+    // between two samples at the new interval.
+    halve_samples();
+    if (timeseries_at_clock) clock_interrupts_left = sample_interval / 2;
+    else timeseries_next_sample = instructions + sample_interval / 2;
+    return;
+  }
+
+  record_sample(instructions);
+  if (!timeseries_at_clock) timeseries_next_sample = instructions + sample_interval;
+}
+
+void timeseries_finish(unsigned int instructions)
+{
+  if (timeseries_path == NULL) return;
+  if (num_samples > 0 && samples[num_samples - 1].instructions == instructions) return;
+  if (num_samples == TIMESERIES_SAMPLES) halve_samples();
+  record_sample(instructions);
+}
+
+unsigned int timeseries_num_samples()
+{
+  return num_samples;
+}
+
+unsigned int timeseries_sample_instructions(unsigned int i)
+{
+  return samples[i].instructions;
+}
+
+void timeseries_save()
+{
+  TIMESERIES_HEADER header;
+  SAMPLE previous;
+  SAMPLE *sample;
+  unsigned int i, interval;
+  int length = strlen(timeseries_path);
+  FILE *file = fopen(timeseries_path, "wb");
+
+  if (file == NULL) {
+    printf("Error: cannot write time series %s\n", timeseries_path);
+    return;
+  }
+
+  if (length > 4 && strcmp(timeseries_path + length - 4, ".bin") == 0) {
+    memcpy(header.magic, TIMESERIES_MAGIC, sizeof(header.magic));
+    header.num_samples = num_samples;
+    header.sample_size = sizeof(SAMPLE);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(samples, sizeof(SAMPLE), num_samples, file);
+  }
+  else {
+    fprintf(file, "instructions,tlb_misses,page_faults,evictions,writebacks,tlb_miss_rate,page_fault_rate\n");
+    memset(&previous, 0, sizeof(previous));
+    for (i = 0; i < num_samples; i++) {
+      sample = &samples[i];
+      interval = sample->instructions - previous.instructions;
+      fprintf(file, "%u,%u,%u,%u,%u,%.6f,%.6f\n", sample->instructions, sample->tlb_misses,
+              sample->page_faults, sample->evictions, sample->writebacks,
+              (double) (sample->tlb_misses - previous.tlb_misses) / interval,
+              (double) (sample->page_faults - previous.page_faults) / interval);
+      previous = *sample;
+    }
+  }
+
+  fclose(file);
+}
@@ -0,0 +1,34 @@
+
+/* Time series of the run's counters. Setting TIMESERIES_SAVE=file
+   in the environment records the instruction count, TLB misses,
+   page faults, evictions and write-backs every TIMESERIES_EVERY
+   instructions, or at every clock interrupt if that is unset, and
+   writes them to the file at exit: as CSV, with the miss and fault
+   rates of each interval, or as raw records if the name ends in
+   ".bin". */
+
+// Size of the sample buffer. When it fills up, every other sample
+// is dropped and the sampling interval doubles.
+#ifndef TIMESERIES_SAMPLES
+#define TIMESERIES_SAMPLES 65536
+#endif
+
+// Reads the environment. Called by the CPU at startup.
+void timeseries_initialize();
+
+// Instruction count at which the CPU next calls timeseries_sample
+// (never, unless sampling by instructions), and whether it calls it
+// at clock interrupts.
+extern unsigned int timeseries_next_sample;
+extern BOOL timeseries_at_clock;
+
+// Records the counters after the given number of instructions.
+void timeseries_sample(unsigned int instructions);
+
+// Records the counters at the end of the run, if sampling.
+void timeseries_finish(unsigned int instructions);
+
+// The samples held so far: how many, and the instruction count of
+// the i'th.
+unsigned int timeseries_num_samples();
+unsigned int timeseries_sample_instructions(unsigned int i);
@@ -1,4 +1,10 @@
 
+// Number of simulated CPUs. Each has its own TLB; they share
+// the page table and take turns running.
+#ifndef NUM_CPUS
+#define NUM_CPUS 1
+#endif
+
 //This variable determines the size (in
 //terms of number of entries) of the TLB.
 extern unsigned int num_tlb_entries;
@@ -28,6 +34,11 @@ void tlb_insert(VPAGE_NUMBER new_vpage, PAGEFRAME_NUMBER new_pframe,
 // virtual page, by clearing the valid bit for that entry.
 void tlb_clear_entry(VPAGE_NUMBER vpage);
 
+// Clears the entries for count virtual pages starting at start,
+// looking each page up for a short range and otherwise making a
+// single pass over the TLB.
+void tlb_clear_range(VPAGE_NUMBER start, unsigned int count);
+
 // This clears out the entire TLB, by clearing the
 // valid bit for every entry.
 void tlb_clear_all();
@@ -40,3 +51,19 @@ void tlb_write_back();
 // by the OS at each clock interrupt.
 void tlb_clear_all_R_bits();
 
+
+// The CPU whose TLB is in use. tlb_switch_cpu makes another CPU
+// the running one, writing back the TLB of the CPU it stops and
+// applying the shootdowns queued for the CPU it starts.
+extern int current_cpu;
+void tlb_switch_cpu(int cpu);
+
+// Prints the lookup and micro-TLB hit counts, and with several
+// CPUs the CPU switch and shootdown counts.
+void tlb_print_statistics();
+
+// Snapshot support. tlb_save_state writes the TLB entries, clock
+// hand and shootdown queue of each CPU to the file; tlb_restore_state loads them back from a
+// mapped snapshot ending at end and returns a pointer just past them.
+void tlb_save_state(FILE *file);
+const char *tlb_restore_state(const char *state, const char *end);
@@ -0,0 +1,300 @@
+/***********************************/
+/****** Synthetic workloads ********/
+/** Operating Systems Project #3 ***/
+/***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "types.h"
+#include "cpu.h"
+#include "workload.h"
+
+/* Fraction of instructions that are stores, in thousandths, the
+   same mix the CPU's own generator uses. */
+#define STORE_PER_THOUSAND 100
+
+#define WORKLOAD_SEED 1000
+
+#define ZIPF_WORKLOAD   0
+#define SEQ_WORKLOAD    1
+#define CHASE_WORKLOAD  2
+#define PHASE_WORKLOAD  3
+#define FORK_WORKLOAD   4
+
+BOOL workload_selected = FALSE;
+
+int workload;
+double workload_param[2];
+
+
+/*************************************/
+/************* xoshiro128** **********/
+/*************************************/
+
+/* A small, fast generator with 128 bits of state. The state is
+   seeded from WORKLOAD_SEED with splitmix32, so every run with the
+   same workload issues the same instructions. */
+
+unsigned int rng_state[4];
+
+#define rotl(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
+
+unsigned int next_random()
+{
+  unsigned int result = rotl(rng_state[1] * 5, 7) * 9;
+  unsigned int t = rng_state[1] << 9;
+
+  rng_state[2] ^= rng_state[0];
+  rng_state[3] ^= rng_state[1];
+  rng_state[1] ^= rng_state[2];
+  rng_state[0] ^= rng_state[3];
+  rng_state[2] ^= t;
+  rng_state[3] = rotl(rng_state[3], 11);
+  return result;
+}
+
+// Uniform in [0, 1).
+#define next_uniform() (next_random() * (1.0 / 4294967296.0))
+
+void seed_random(unsigned int seed)
+{
+  unsigned int z;
+  int i;
+  for (i = 0; i < 4; i++) {
+    seed += 0x9E3779B9;
+    z = seed;
+    z = (z ^ (z >> 16)) * 0x85EBCA6B;
+    z = (z ^ (z >> 13)) * 0xC2B2AE35;
+    rng_state[i] = z ^ (z >> 16);
+  }
+}
+
+
+/*************************************/
+/************ Zipfian pages **********/
+/*************************************/
+
+/* Page ranks are drawn with the method of Gray et al., "Quickly
+   Generating Billion-Record Synthetic Databases": constant time per
+   draw after computing zeta(num_pages) once. Ranks are scattered
+   over the address space by multiplying with an odd constant, which
+   is a bijection modulo the (power of 2) number of pages. */
+
+double zipf_theta, zipf_alpha, zipf_zetan, zipf_eta, zipf_half_pow_theta;
+
+void initialize_zipf(double theta)
+{
+  unsigned int i;
+  double zeta2;
+
+  zipf_theta = theta;
+  zipf_zetan = 0;
+  for (i = 1; i <= num_pages; i++) zipf_zetan += 1.0 / pow(i, theta);
+  zipf_half_pow_theta = pow(0.5, theta);
+  zeta2 = 1 + zipf_half_pow_theta;
+  zipf_alpha = 1.0 / (1.0 - theta);
+  zipf_eta = (1 - pow(2.0 / num_pages, 1 - theta)) / (1 - zeta2 / zipf_zetan);
+}
+
+VPAGE_NUMBER next_zipf_page()
+{
+  double u = next_uniform();
+  double uz = u * zipf_zetan;
+  unsigned int rank;
+
+  if (uz < 1) rank = 0;
+  else if (uz < 1 + zipf_half_pow_theta) rank = 1;
+  else rank = (unsigned int) (num_pages * pow(zipf_eta * u - zipf_eta + 1, zipf_alpha));
+  return (rank * 0x9E3779B1) & num_pages_mod_mask;
+}
+
+
+/*************************************/
+/********** Pointer chasing **********/
+/*************************************/
+
+// next_in_cycle[v] is the page visited after page v. Sattolo's
+// algorithm makes it a single cycle through every page.
+VPAGE_NUMBER *next_in_cycle;
+
+void initialize_chase()
+{
+  unsigned int i, j;
+  VPAGE_NUMBER tmp;
+
+  next_in_cycle = malloc(num_pages * sizeof(VPAGE_NUMBER));
+  for (i = 0; i < num_pages; i++) next_in_cycle[i] = i;
+  for (i = num_pages - 1; i > 0; i--) {
+    j = next_random() % i;
+    tmp = next_in_cycle[i];
+    next_in_cycle[i] = next_in_cycle[j];
+    next_in_cycle[j] = tmp;
+  }
+}
+
+
+/*************************************/
+/************* Interface *************/
+/*************************************/
+
+void invalid_workload(const char *spec)
+{
+  printf("Invalid workload: %s\n", spec);
+  exit(1);
+}
+
+void workload_select(const char *spec)
+{
+  const char *params = strchr(spec, ':');
+  int length = params ? params - spec : strlen(spec);
+  int max_params;
+  int n = 0;
+  char *end;
+
+  if (length == 4 && strncmp(spec, "zipf", 4) == 0) {
+    workload = ZIPF_WORKLOAD;
+    workload_param[0] = 0.99;
+    max_params = 1;
+  }
+  else if (length == 3 && strncmp(spec, "seq", 3) == 0) {
+    workload = SEQ_WORKLOAD;
+    workload_param[0] = 4;
+    max_params = 1;
+  }
+  else if (length == 5 && strncmp(spec, "chase", 5) == 0) {
+    workload = CHASE_WORKLOAD;
+    max_params = 0;
+  }
+  else if (length == 5 && strncmp(spec, "phase", 5) == 0) {
+    workload = PHASE_WORKLOAD;
+    workload_param[0] = 64;
+    workload_param[1] = 100000;
+    max_params = 2;
+  }
+  else if (length == 4 && strncmp(spec, "fork", 4) == 0) {
+    workload = FORK_WORKLOAD;
+    workload_param[0] = 64;
+    workload_param[1] = 100000;
+    max_params = 2;
+  }
+  else invalid_workload(spec);
+
+  // Each parameter is a number, and ends the spec or is followed
+  // by the next one.
+  while (params != NULL) {
+    if (n == max_params) invalid_workload(spec);
+    workload_param[n++] = strtod(params + 1, &end);
+    if (end == params + 1 || (*end != ':' && *end != '\0')) invalid_workload(spec);
+    params = (*end == ':') ? end : NULL;
+  }
+  if ((workload == ZIPF_WORKLOAD && (workload_param[0] <= 0 || workload_param[0] >= 1)) ||
+      (workload == SEQ_WORKLOAD && workload_param[0] < 1) ||
+      ((workload == PHASE_WORKLOAD || workload == FORK_WORKLOAD) &&
+       (workload_param[0] < 1 || workload_param[1] < 1)))
+    invalid_workload(spec);
+  workload_selected = TRUE;
+}
+
+// State of the workloads as they run.
+unsigned int seq_position;
+unsigned int seq_stride;
+VPAGE_NUMBER chase_page;
+VPAGE_NUMBER phase_base;
+unsigned int phase_pages;
+unsigned int phase_length;
+unsigned int phase_left;
+unsigned int fork_pages;
+unsigned int fork_length;
+unsigned int fork_left;
+BOOL fork_pending = FALSE;
+
+void workload_initialize(OPERATION *op, VPAGE_NUMBER *vpage, unsigned int *offset)
+{
+  seed_random(WORKLOAD_SEED);
+  switch (workload) {
+  case ZIPF_WORKLOAD:
+    initialize_zipf(workload_param[0]);
+    break;
+  case SEQ_WORKLOAD:
+    seq_stride = (unsigned int) workload_param[0];
+    seq_position = 0;
+    break;
+  case CHASE_WORKLOAD:
+    initialize_chase();
+    chase_page = 0;
+    break;
+  case PHASE_WORKLOAD:
+    phase_pages = (unsigned int) workload_param[0];
+    if (phase_pages > num_pages) phase_pages = num_pages;
+    phase_length = (unsigned int) workload_param[1];
+    phase_left = 0;
+    break;
+  case FORK_WORKLOAD:
+    if (num_pages < 2) {
+      printf("Invalid workload: fork needs at least 2 pages\n");
+      exit(1);
+    }
+    fork_pages = (unsigned int) workload_param[0];
+    if (fork_pages > num_pages / 2) fork_pages = num_pages / 2;
+    fork_length = (unsigned int) workload_param[1];
+    fork_left = fork_length;
+    break;
+  }
+  workload_next(op, vpage, offset);
+}
+
+void workload_next(OPERATION *op, VPAGE_NUMBER *vpage, unsigned int *offset)
+{
+  *op = (next_random() % 1000 < STORE_PER_THOUSAND) ? STORE : LOAD;
+
+  switch (workload) {
+  case ZIPF_WORKLOAD:
+    *vpage = next_zipf_page();
+    *offset = next_random() & 0xFFF;
+    break;
+  case SEQ_WORKLOAD:
+    seq_position += seq_stride;
+    *vpage = (seq_position >> 12) & num_pages_mod_mask;
+    *offset = seq_position & 0xFFF;
+    break;
+  case CHASE_WORKLOAD:
+    chase_page = next_in_cycle[chase_page];
+    *vpage = chase_page;
+    *offset = next_random() & 0xFFF;
+    break;
+  case PHASE_WORKLOAD:
+    if (phase_left == 0) {
+      phase_base = next_random() & num_pages_mod_mask;
+      phase_left = phase_length;
+    }
+    phase_left--;
+    *vpage = (phase_base + next_random() % phase_pages) & num_pages_mod_mask;
+    *offset = next_random() & 0xFFF;
+    break;
+  case FORK_WORKLOAD:
+    // The parent's pages are at the bottom of the address space and
+    // the child's in the upper half. The child exits and the parent
+    // forks a new one every fork_length instructions.
+    if (fork_left == 0) {
+      fork_pending = TRUE;
+      fork_left = fork_length;
+    }
+    fork_left--;
+    *vpage = next_random() % fork_pages;
+    if (next_random() & 1) *vpage += num_pages / 2;
+    *offset = next_random() & 0xFFF;
+    break;
+  }
+}
+
+BOOL workload_fork(VPAGE_NUMBER *parent, VPAGE_NUMBER *child, unsigned int *count)
+{
+  if (!fork_pending) return FALSE;
+  fork_pending = FALSE;
+  *parent = 0;
+  *child = num_pages / 2;
+  *count = fork_pages;
+  return TRUE;
+}
@@ -0,0 +1,30 @@
+
+// Synthetic workloads, chosen with -w<name>[:<param>[:<param>]]
+// in place of the CPU's own instruction mix:
+//
+//   -wzipf[:theta]         Zipfian page popularity, 0 < theta < 1 (default 0.99)
+//   -wseq[:stride]         sequential scan, stride in bytes (default 4)
+//   -wchase                pointer chasing around a random cycle of pages
+//   -wphase[:pages[:len]]  a working set of pages (default 64) that moves
+//                          every len instructions (default 100000)
+//   -wfork[:pages[:len]]   a parent and a child touching pages pages each
+//                          (default 64); every len instructions (default
+//                          100000) the child exits and the parent forks
+//                          a new one, sharing its pages copy-on-write
+
+// TRUE once a workload has been chosen.
+extern BOOL workload_selected;
+
+// Chooses the workload described by spec (the text after -w).
+void workload_select(const char *spec);
+
+// Sets up the chosen workload and picks its first instruction.
+// Called once num_pages is known.
+void workload_initialize(OPERATION *op, VPAGE_NUMBER *vpage, unsigned int *offset);
+
+// Picks the operation, virtual page and offset of the next instruction.
+void workload_next(OPERATION *op, VPAGE_NUMBER *vpage, unsigned int *offset);
+
+// TRUE if the process forks before the instruction just issued. The
+// child's count pages from child on share the parent's from parent on.
+BOOL workload_fork(VPAGE_NUMBER *parent, VPAGE_NUMBER *child, unsigned int *count);